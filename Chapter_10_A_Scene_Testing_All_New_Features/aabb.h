@@ -11,22 +11,41 @@ class aabb {
         point3 min() const {return _min; }
         point3 max() const {return _max; }
 
+        point3 centroid() const { return 0.5 * (_min + _max); }
+
+        double surface_area() const {
+            auto d = _max - _min;
+            return 2 * (d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+        }
+
+        // A box that contains nothing, to grow from with surrounding_box()
+        static aabb empty() {
+            return aabb(point3(infinity, infinity, infinity), point3(-infinity, -infinity, -infinity));
+        }
+
+        // Slab test using the ray's cached reciprocal direction. The sign bits pick the
+        // near and far plane of each slab, so there is no swap or early exit. A ray lying
+        // in a slab's plane yields 0 * inf = NaN; the comparisons are written so that a NaN
+        // leaves the interval untouched. The far distance is widened by a few ulps so that
+        // rounding never loses a hit grazing the box.
         bool hit(const ray& r, double tmin, double tmax) const {
+            const point3* bounds[2] = { &_min, &_max };
             for (int a = 0; a < 3; a++) {
-                auto invD = 1.0f / r.direction()[a];
-                auto t0 = (min()[a] - r.origin()[a]) * invD;
-                auto t1 = (max()[a] - r.origin()[a]) * invD;
-                if (invD < 0.0f) std::swap(t0, t1);
+                auto t0 = ((*bounds[r.sign[a]])[a]   - r.orig[a]) * r.inv_dir[a];
+                auto t1 = ((*bounds[1-r.sign[a]])[a] - r.orig[a]) * r.inv_dir[a];
+                t1 *= 1 + 2*slab_gamma;
                 tmin = t0 > tmin ? t0 : tmin;
                 tmax = t1 < tmax ? t1 : tmax;
-
-                if (tmax <= tmin) return false;
             }
-            return true;
+            return tmin <= tmax;
         }
 
         point3 _min;
         point3 _max;
+
+        // Bound on the relative rounding error of the three operations in a slab distance
+        static constexpr double slab_gamma = 3 * 0.5 * std::numeric_limits<double>::epsilon()
+                                           / (1 - 3 * 0.5 * std::numeric_limits<double>::epsilon());
 };
 
 aabb surrounding_box(aabb box0, aabb box1) {
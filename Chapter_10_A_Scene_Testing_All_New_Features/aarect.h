@@ -2,6 +2,7 @@
 #define AARECT_H
 
 #include "hittable.h"
+#include "material.h"
 
 class xy_rect : public hittable 
 {
@@ -12,6 +13,7 @@ class xy_rect : public hittable
             : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {};
 
         virtual bool hit(const ray& r, double t0, double t1, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t0, double t1) const override;
 
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const override 
         {
@@ -21,6 +23,10 @@ class xy_rect : public hittable
             return true;
         }
 
+        virtual bool is_emitter() const override { return mp->is_emissive(); }
+        virtual double pdf_value(const point3& o, const vec3& v) const override;
+        virtual vec3 random(const point3& o) const override;
+
     public:
         double x0, x1, y0, y1, k;
         shared_ptr<material> mp;
@@ -35,6 +41,7 @@ class xz_rect : public hittable {
             : x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
         virtual bool hit(const ray& r, double t0, double t1, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t0, double t1) const override;
 
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const override {
             // The bounding box must have non-zero width in each dimension, so pad the Y
@@ -43,6 +50,10 @@ class xz_rect : public hittable {
             return true;
         }
 
+        virtual bool is_emitter() const override { return mp->is_emissive(); }
+        virtual double pdf_value(const point3& o, const vec3& v) const override;
+        virtual vec3 random(const point3& o) const override;
+
     public:
         double x0, x1, z0, z1, k;
         shared_ptr<material> mp;
@@ -58,6 +69,7 @@ class yz_rect : public hittable
             : y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
         virtual bool hit(const ray& r, double t0, double t1, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t0, double t1) const override;
 
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const override {
             // The bounding box must have non-zero width in each dimension, so pad the X
@@ -66,11 +78,25 @@ class yz_rect : public hittable
             return true;
         }
 
+        virtual bool is_emitter() const override { return mp->is_emissive(); }
+        virtual double pdf_value(const point3& o, const vec3& v) const override;
+        virtual vec3 random(const point3& o) const override;
+
     public:
         double y0, y1, z0, z1, k;
         shared_ptr<material> mp;
 };
 
+bool xy_rect::occluded(const ray& r, double t0, double t1) const
+{
+    auto t = (k-r.origin().z()) / r.direction().z();
+    if (t < t0 || t > t1)
+        return false;
+    auto x = r.origin().x() + t*r.direction().x();
+    auto y = r.origin().y() + t*r.direction().y();
+    return x >= x0 && x <= x1 && y >= y0 && y <= y1;
+}
+
 bool xy_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const
 {
     auto t = (k-r.origin().z()) / r.direction().z();
@@ -90,6 +116,16 @@ bool xy_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const
     return true;
 }
 
+bool xz_rect::occluded(const ray& r, double t0, double t1) const
+{
+    auto t = (k-r.origin().y()) / r.direction().y();
+    if (t < t0 || t > t1)
+        return false;
+    auto x = r.origin().x() + t*r.direction().x();
+    auto z = r.origin().z() + t*r.direction().z();
+    return x >= x0 && x <= x1 && z >= z0 && z <= z1;
+}
+
 bool xz_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
     auto t = (k-r.origin().y()) / r.direction().y();
     if (t < t0 || t > t1)
@@ -108,6 +144,16 @@ bool xz_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
     return true;
 }
 
+bool yz_rect::occluded(const ray& r, double t0, double t1) const
+{
+    auto t = (k-r.origin().x()) / r.direction().x();
+    if (t < t0 || t > t1)
+        return false;
+    auto y = r.origin().y() + t*r.direction().y();
+    auto z = r.origin().z() + t*r.direction().z();
+    return y >= y0 && y <= y1 && z >= z0 && z <= z1;
+}
+
 bool yz_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
     auto t = (k-r.origin().x()) / r.direction().x();
     if (t < t0 || t > t1)
@@ -126,4 +172,61 @@ bool yz_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
     return true;
 }
 
+double xy_rect::pdf_value(const point3& o, const vec3& v) const
+{
+    hit_record rec;
+    if (!this->hit(ray(o, v), 0.001, infinity, rec)) return 0;
+
+    // Convert the uniform density over the area into a density over solid angle
+    auto area = (x1-x0)*(y1-y0);
+    auto distance_squared = rec.t * rec.t * v.length_squared();
+    auto cosine = fabs(dot(v, rec.normal) / v.length());
+
+    return distance_squared / (cosine * area);
+}
+
+vec3 xy_rect::random(const point3& o) const
+{
+    auto random_point = point3(random_double(x0,x1), random_double(y0,y1), k);
+    return random_point - o;
+}
+
+double xz_rect::pdf_value(const point3& o, const vec3& v) const
+{
+    hit_record rec;
+    if (!this->hit(ray(o, v), 0.001, infinity, rec)) return 0;
+
+    // Convert the uniform density over the area into a density over solid angle
+    auto area = (x1-x0)*(z1-z0);
+    auto distance_squared = rec.t * rec.t * v.length_squared();
+    auto cosine = fabs(dot(v, rec.normal) / v.length());
+
+    return distance_squared / (cosine * area);
+}
+
+vec3 xz_rect::random(const point3& o) const
+{
+    auto random_point = point3(random_double(x0,x1), k, random_double(z0,z1));
+    return random_point - o;
+}
+
+double yz_rect::pdf_value(const point3& o, const vec3& v) const
+{
+    hit_record rec;
+    if (!this->hit(ray(o, v), 0.001, infinity, rec)) return 0;
+
+    // Convert the uniform density over the area into a density over solid angle
+    auto area = (y1-y0)*(z1-z0);
+    auto distance_squared = rec.t * rec.t * v.length_squared();
+    auto cosine = fabs(dot(v, rec.normal) / v.length());
+
+    return distance_squared / (cosine * area);
+}
+
+vec3 yz_rect::random(const point3& o) const
+{
+    auto random_point = point3(k, random_double(y0,y1), random_double(z0,z1));
+    return random_point - o;
+}
+
 #endif
@@ -0,0 +1,122 @@
+#ifndef ACCEL_H
+#define ACCEL_H
+
+#include <cstring>
+
+#include "bvh.h"
+#include "bvh_cache.h"
+#include "linear_bvh.h"
+#include "motion_bvh.h"
+#include "wide_bvh.h"
+
+// The BVH layouts a hittable_list can be built into. They all use the same builders
+// and differ only in how the tree is stored and traversed. The motion layout is the
+// linear one with node boxes interpolated to each ray's time.
+enum class bvh_layout { binary, linear, bvh4, bvh8, motion };
+
+inline bool parse_bvh_layout(const char* name, bvh_layout& layout)
+{
+    if      (!strcmp(name, "binary")) layout = bvh_layout::binary;
+    else if (!strcmp(name, "linear")) layout = bvh_layout::linear;
+    else if (!strcmp(name, "bvh4"))   layout = bvh_layout::bvh4;
+    else if (!strcmp(name, "bvh8"))   layout = bvh_layout::bvh8;
+    else if (!strcmp(name, "motion")) layout = bvh_layout::motion;
+    else return false;
+    return true;
+}
+
+inline bool parse_bvh_builder(const char* name, bvh_builder& builder)
+{
+    if      (!strcmp(name, "sah"))  builder = bvh_builder::sah;
+    else if (!strcmp(name, "lbvh")) builder = bvh_builder::lbvh;
+    else return false;
+    return true;
+}
+
+inline bool parse_morton_bits(const char* text, int& bits)
+{
+    if      (!strcmp(text, "30")) bits = 30;
+    else if (!strcmp(text, "63")) bits = 63;
+    else return false;
+    return true;
+}
+
+shared_ptr<hittable> make_bvh(hittable_list& list, double time0, double time1, bvh_layout layout,
+                              const bvh_build_options& options = bvh_build_options())
+{
+    switch (layout) {
+        case bvh_layout::binary: return make_shared<bvh_node>(list, time0, time1, options);
+        case bvh_layout::bvh4:   return make_shared<bvh4>(list, time0, time1, options);
+        case bvh_layout::bvh8:   return make_shared<bvh8>(list, time0, time1, options);
+        case bvh_layout::motion: return make_shared<motion_bvh>(list, time0, time1, options);
+        default:                 return make_shared<linear_bvh>(list, time0, time1, options);
+    }
+}
+
+// Like make_bvh(), but the binary tree behind the flattened layouts is first looked up in
+// cache_dir, under a file named after the cache key, and written there after a build.
+// The pointer-based binary layout can't be stored and is always built.
+shared_ptr<hittable> make_cached_bvh(hittable_list& list, double time0, double time1, bvh_layout layout,
+                                     const bvh_build_options& options, const std::string& cache_dir)
+{
+    if (layout == bvh_layout::binary) return make_bvh(list, time0, time1, layout, options);
+
+    auto key = bvh_cache_key(list, time0, time1, options);
+    char name[32];
+    std::snprintf(name, sizeof(name), "bvh-%016llx.bin", static_cast<unsigned long long>(key));
+    auto filename = cache_dir + "/" + name;
+
+    linear_bvh binary;
+    if (!load_bvh_cache(filename, key, list, options, binary)) {
+        binary = linear_bvh(list, time0, time1, options);
+        if (!save_bvh_cache(filename, key, list, binary))
+            std::cerr << "Could not write BVH cache '" << filename << "'.\n";
+    }
+
+    switch (layout) {
+        case bvh_layout::bvh4:   return make_shared<bvh4>(binary, options);
+        case bvh_layout::bvh8:   return make_shared<bvh8>(binary, options);
+        case bvh_layout::motion: return make_shared<motion_bvh>(binary, time0, time1, options);
+        default:                 return make_shared<linear_bvh>(std::move(binary));
+    }
+}
+
+// SAH cost of a tree made by make_bvh(), or 0 for anything else.
+double bvh_sah_cost(const hittable& object, const bvh_build_options& options = bvh_build_options())
+{
+    if (auto p = dynamic_cast<const bvh_node*>(&object))   return p->sah_cost(options);
+    if (auto p = dynamic_cast<const linear_bvh*>(&object)) return p->sah_cost(options);
+    if (auto p = dynamic_cast<const bvh4*>(&object))       return p->sah_cost(options);
+    if (auto p = dynamic_cast<const bvh8*>(&object))       return p->sah_cost(options);
+    if (auto p = dynamic_cast<const motion_bvh*>(&object)) return p->sah_cost(options);
+    return 0.0;
+}
+
+// Refits tree to its objects' current bounds, and rebuilds it when the refitted tree's
+// SAH cost has grown past max_growth times the cost it was built with.
+template <typename bvh>
+bool refit_or_rebuild(bvh& tree, double time0, double time1, const bvh_build_options& options, double max_growth)
+{
+    tree.refit(time0, time1);
+    if (tree.sah_cost(options) <= max_growth * tree.built_cost) return false;
+
+    tree.rebuild(time0, time1, options);
+    return true;
+}
+
+// Brings a tree made by make_bvh() up to date after its objects have moved, for example
+// between the frames of an animation. Refitting keeps the topology and only recomputes
+// boxes, which is far cheaper than building, but the tree gets worse as objects drift away
+// from where it was built for. Returns whether the tree had to be rebuilt.
+bool bvh_update(hittable& object, double time0, double time1,
+                const bvh_build_options& options = bvh_build_options(), double max_growth = 1.3)
+{
+    if (auto p = dynamic_cast<bvh_node*>(&object))   return refit_or_rebuild(*p, time0, time1, options, max_growth);
+    if (auto p = dynamic_cast<linear_bvh*>(&object)) return refit_or_rebuild(*p, time0, time1, options, max_growth);
+    if (auto p = dynamic_cast<bvh4*>(&object))       return refit_or_rebuild(*p, time0, time1, options, max_growth);
+    if (auto p = dynamic_cast<bvh8*>(&object))       return refit_or_rebuild(*p, time0, time1, options, max_growth);
+    if (auto p = dynamic_cast<motion_bvh*>(&object)) return refit_or_rebuild(*p, time0, time1, options, max_growth);
+    return false;
+}
+
+#endif
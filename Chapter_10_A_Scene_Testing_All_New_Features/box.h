@@ -11,6 +11,11 @@ class box : public hittable  {
 
         virtual bool hit(const ray& r, double t0, double t1, hit_record& rec) const override;
 
+        virtual bool occluded(const ray& r, double t0, double t1) const override
+        {
+            return sides.occluded(r, t0, t1);
+        }
+
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const override {
             output_box = aabb(box_min, box_max);
             return true;
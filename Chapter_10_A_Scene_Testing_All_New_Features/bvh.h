@@ -2,97 +2,467 @@
 #define BVH_H
 
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <thread>
 
+#include "bvh_counters.h"
 #include "hittable_list.h"
 
-class bvh_node : public hittable 
+// How the builders choose where to split a range of primitives. The SAH builder searches
+// binned split planes for the cheapest one. The LBVH builder sorts the primitives once by
+// the Morton code of their centroids and splits each range where the highest differing
+// code bit changes, which is much faster but gives a somewhat worse tree.
+enum class bvh_builder { sah, lbvh };
+
+// Cost model and resolution of the surface area heuristic (SAH) builder. The expected
+// cost of a tree is the traversal cost of each interior node plus the intersection cost
+// of each primitive, weighted by the chance that a ray hitting the root also hits the
+// node's box, which is proportional to its surface area.
+struct bvh_build_options
 {
-    public:
-        bvh_node();
+    int bins = 16;                  // candidate split planes per axis are bins - 1
+    double traversal_cost = 1.0;    // cost of visiting an interior node
+    double intersection_cost = 1.0; // cost of intersecting one primitive
+    int max_leaf_size = 4;          // most primitives a leaf may hold, from 1 to 8
+    int build_threads = 0;          // threads the builder may use, 0 uses every core
+    bvh_builder builder = bvh_builder::sah;
+    int morton_bits = 63;           // LBVH code length, 30 or 63
+};
 
-        bvh_node(hittable_list& list, double time0, double time1) 
-            : bvh_node(list.objects, 0, list.objects.size(), time0, time1) {}
+// Chance that a ray through a box of parent_area also passes through a box of child_area
+// inside it. Boxes too large for their area to be represented, such as single-precision
+// node bounds that rounded out to infinity, count as always hit instead of making the
+// cost NaN.
+inline double bvh_area_ratio(double child_area, double parent_area)
+{
+    if (!std::isfinite(child_area) || !std::isfinite(parent_area) || !(parent_area > 0)) return 1.0;
+    return child_area / parent_area;
+}
 
-        bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, double time0, double time1);
+// Ranges smaller than this are built on the thread that split them; handing them to
+// another thread costs more than it saves.
+const size_t bvh_parallel_min_span = 4096;
 
-        virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const override;
+inline int bvh_build_tasks(const bvh_build_options& options)
+{
+    if (options.build_threads > 0) return options.build_threads;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
 
-        virtual bool bounding_box(double t0, double t1, aabb& output_box) const override;
+// Trees are kept to this many levels below the root, so that traversal stacks stay small.
+const int bvh_max_depth = 64;
 
-    public:
-        shared_ptr<hittable> left;
-        shared_ptr<hittable> right;
-        aabb box;
+inline size_t bvh_max_leaf_span(const bvh_build_options& options)
+{
+    return static_cast<size_t>(std::clamp(options.max_leaf_size, 1, 8));
+}
+
+// A leaf is made when the range is small enough and intersecting all of its primitives is
+// no more expensive than the best split found for it.
+inline bool bvh_make_leaf(size_t span, double split_cost, const bvh_build_options& options)
+{
+    return span == 1 || (span <= bvh_max_leaf_span(options) && options.intersection_cost * span <= split_cost);
+}
+
+// An object together with the box and centroid the builder sorts it by.
+struct bvh_primitive
+{
+    shared_ptr<hittable> object;
+    aabb box;
+    point3 centroid;
+    uint64_t morton = 0;    // Morton code of the centroid, set by the LBVH builder only
 };
 
-inline bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis)
+inline std::vector<bvh_primitive> make_bvh_primitives(
+    const std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, double time0, double time1)
+{
+    std::vector<bvh_primitive> prims(end - start);
+    for (size_t i = start; i < end; i++) {
+        auto& prim = prims[i - start];
+        prim.object = objects[i];
+        if (!prim.object->bounding_box(time0, time1, prim.box))
+            std::cerr << "No bounding box in bvh_node constructor.\n";
+        prim.centroid = prim.box.centroid();
+    }
+    return prims;
+}
+
+// Finds the cheapest binned SAH split of prims[start,end) and partitions the range so that
+// [start,mid) goes to the left child. Returns the SAH cost of the split, relative to the
+// node's own surface area, and sets the split axis. When all centroids coincide, no plane
+// separates them and the range is cut in half.
+double bvh_sah_split(std::vector<bvh_primitive>& prims, size_t start, size_t end,
+                     const bvh_build_options& options, int& axis, size_t& mid)
 {
-    aabb box_a;
-    aabb box_b;
+    auto node_box = aabb::empty();
+    auto centroid_box = aabb::empty();
+    for (size_t i = start; i < end; i++) {
+        node_box = surrounding_box(node_box, prims[i].box);
+        centroid_box = surrounding_box(centroid_box, aabb(prims[i].centroid, prims[i].centroid));
+    }
+
+    const int bins = std::max(options.bins, 2);
+    std::vector<aabb> bin_box(bins);
+    std::vector<size_t> bin_count(bins);
+    std::vector<aabb> right_box(bins);
+    std::vector<size_t> right_count(bins);
+
+    auto best_cost = infinity;
+    int best_bin = -1;
+    axis = 0;
 
-    if (!a->bounding_box(0,0, box_a) || !b->bounding_box(0,0, box_b))
-        std::cerr << "No bounding box in bvh_node constructor.\n";
+    for (int a = 0; a < 3; a++) {
+        auto lo = centroid_box.min()[a];
+        auto extent = centroid_box.max()[a] - lo;
+        if (extent <= 0) continue;
+        auto scale = bins / extent;
 
-    return box_a.min().e[axis] < box_b.min().e[axis];
+        std::fill(bin_box.begin(), bin_box.end(), aabb::empty());
+        std::fill(bin_count.begin(), bin_count.end(), 0);
+        for (size_t i = start; i < end; i++) {
+            int b = std::min(static_cast<int>((prims[i].centroid[a] - lo) * scale), bins - 1);
+            bin_box[b] = surrounding_box(bin_box[b], prims[i].box);
+            bin_count[b]++;
+        }
+
+        // Sweep from the right to get the boxes and counts of every right-hand side, then
+        // from the left, evaluating the plane after bin b.
+        auto box = aabb::empty();
+        size_t count = 0;
+        for (int b = bins - 1; b > 0; b--) {
+            box = surrounding_box(box, bin_box[b]);
+            count += bin_count[b];
+            right_box[b] = box;
+            right_count[b] = count;
+        }
+
+        box = aabb::empty();
+        count = 0;
+        for (int b = 0; b < bins - 1; b++) {
+            box = surrounding_box(box, bin_box[b]);
+            count += bin_count[b];
+            if (count == 0 || right_count[b+1] == 0) continue;
+
+            auto cost = box.surface_area() * count + right_box[b+1].surface_area() * right_count[b+1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_bin = b;
+                axis = a;
+            }
+        }
+    }
+
+    if (best_bin < 0) {
+        mid = start + (end - start) / 2;
+        return options.traversal_cost + options.intersection_cost * (end - start);
+    }
+
+    auto lo = centroid_box.min()[axis];
+    auto scale = bins / (centroid_box.max()[axis] - lo);
+    auto split = std::partition(prims.begin() + start, prims.begin() + end, [&](const bvh_primitive& p) {
+        return std::min(static_cast<int>((p.centroid[axis] - lo) * scale), bins - 1) <= best_bin;
+    });
+    mid = split - prims.begin();
+
+    return options.traversal_cost + options.intersection_cost * best_cost / node_box.surface_area();
 }
 
-bool box_x_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) 
+// Spreads the low 21 bits of v out so that two zero bits follow each of them.
+inline uint64_t morton_expand(uint64_t v)
 {
-    return box_compare(a, b, 0);
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8)  & 0x100f00f00f00f00full;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2)  & 0x1249249249249249ull;
+    return v;
 }
 
-bool box_y_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) 
+// Which axis a bit of an interleaved code belongs to. x takes the highest bit of each triple.
+inline int morton_axis(int bit) { return 2 - bit % 3; }
+
+// Gives every primitive the Morton code of its centroid, quantized within the centroid
+// bounds to 10 (30-bit codes) or 21 (63-bit codes) bits per axis, and sorts them by it
+// with an LSD radix sort, one byte per pass.
+void bvh_morton_sort(std::vector<bvh_primitive>& prims, int morton_bits)
 {
-    return box_compare(a, b, 1);
+    const int axis_bits = morton_bits <= 30 ? 10 : 21;
+    const double cells = double(1 << axis_bits);
+
+    auto centroid_box = aabb::empty();
+    for (const auto& prim : prims) centroid_box = surrounding_box(centroid_box, aabb(prim.centroid, prim.centroid));
+
+    struct keyed { uint64_t code; uint32_t index; };
+    std::vector<keyed> keys(prims.size()), sorted(prims.size());
+    for (size_t i = 0; i < prims.size(); i++) {
+        uint64_t code = 0;
+        for (int a = 0; a < 3; a++) {
+            auto extent = centroid_box.max()[a] - centroid_box.min()[a];
+            auto f = extent > 0 ? (prims[i].centroid[a] - centroid_box.min()[a]) / extent : 0.0;
+            auto q = std::min(static_cast<uint64_t>(f * cells), static_cast<uint64_t>(cells) - 1);
+            code |= morton_expand(q) << (2 - a);
+        }
+        keys[i] = { code, static_cast<uint32_t>(i) };
+    }
+
+    for (int shift = 0; shift < 3 * axis_bits; shift += 8) {
+        size_t offsets[257] = {};
+        for (const auto& k : keys) offsets[((k.code >> shift) & 0xff) + 1]++;
+        for (int d = 0; d < 256; d++) offsets[d+1] += offsets[d];
+        for (const auto& k : keys) sorted[offsets[(k.code >> shift) & 0xff]++] = k;
+        keys.swap(sorted);
+    }
+
+    std::vector<bvh_primitive> ordered(prims.size());
+    for (size_t i = 0; i < prims.size(); i++) {
+        ordered[i] = std::move(prims[keys[i].index]);
+        ordered[i].morton = keys[i].code;
+    }
+    prims.swap(ordered);
 }
 
-bool box_z_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) 
+// SAH cost of splitting prims[start,end) at mid, relative to the node's surface area.
+double bvh_partition_cost(const std::vector<bvh_primitive>& prims, size_t start, size_t mid, size_t end,
+                          const bvh_build_options& options)
 {
-    return box_compare(a, b, 2);
+    auto left_box = aabb::empty();
+    auto right_box = aabb::empty();
+    for (size_t i = start; i < mid; i++) left_box = surrounding_box(left_box, prims[i].box);
+    for (size_t i = mid; i < end; i++) right_box = surrounding_box(right_box, prims[i].box);
+
+    auto area = surrounding_box(left_box, right_box).surface_area();
+    auto cost = left_box.surface_area() * (mid - start) + right_box.surface_area() * (end - mid);
+    return options.traversal_cost + options.intersection_cost * cost / area;
 }
 
-bvh_node::bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, 
-        double time0, double time1)
-{
-    int axis = random_int(0,2);
-    auto comparator = (axis == 0) ? box_x_compare
-                    : (axis == 1) ? box_y_compare
-                                  : box_z_compare;
-
-    size_t object_span = end - start;
-
-    if      (object_span == 1) left = right = objects[start];
-    else if (object_span == 2) {
-        if (comparator(objects[start], objects[start+1])) {
-            left = objects[start];
-            right = objects[start+1];} 
-        else {
-            left = objects[start+1];
-            right = objects[start];}} 
+// Splits Morton-sorted prims[start,end) at the highest bit in which the first and last code
+// differ. Every code in between shares the bits above it, so the split is the first code
+// with that bit set, found by binary search. Nothing is reordered, and no box is looked at
+// unless the range may become a leaf: then the SAH cost of the split is returned, as
+// bvh_sah_split() does, so that both builders make leaves by the same rule. Larger ranges
+// are always split and get an infinite cost, which keeps every level from being a pass
+// over all the boxes.
+double bvh_morton_split(const std::vector<bvh_primitive>& prims, size_t start, size_t end,
+                        const bvh_build_options& options, int& axis, size_t& mid)
+{
+    auto diff = prims[start].morton ^ prims[end-1].morton;
+    axis = 0;
+    if (diff == 0) {
+        mid = start + (end - start) / 2;
+    }
     else {
-        std::sort(objects.begin() + start, objects.begin() + end, comparator);
+        int bit = 63;
+        while (!((diff >> bit) & 1)) bit--;
+        axis = morton_axis(bit);
 
-        auto mid = start + object_span/2;
-        left = make_shared<bvh_node>(objects, start, mid, time0, time1);
-        right = make_shared<bvh_node>(objects, mid, end, time0, time1);
+        auto split = std::partition_point(prims.begin() + start, prims.begin() + end,
+            [bit](const bvh_primitive& p) { return !((p.morton >> bit) & 1); });
+        mid = split - prims.begin();
     }
 
-    aabb box_left, box_right;
+    if (end - start > bvh_max_leaf_span(options)) return infinity;
+    return bvh_partition_cost(prims, start, mid, end, options);
+}
+
+// Cuts prims[start,end) in half at the median centroid along the axis where the centroids
+// spread the most.
+double bvh_median_split(std::vector<bvh_primitive>& prims, size_t start, size_t end,
+                        const bvh_build_options& options, int& axis, size_t& mid)
+{
+    auto centroid_box = aabb::empty();
+    for (size_t i = start; i < end; i++)
+        centroid_box = surrounding_box(centroid_box, aabb(prims[i].centroid, prims[i].centroid));
+
+    auto extent = centroid_box.max() - centroid_box.min();
+    axis = extent.x() >= extent.y() && extent.x() >= extent.z() ? 0 : extent.y() >= extent.z() ? 1 : 2;
 
-    if (  !left ->bounding_box(time0, time1, box_left) || !right->bounding_box(time0, time1, box_right))
-        std::cerr << "No bounding box in bvh_node constructor.\n";
+    mid = start + (end - start) / 2;
+    std::nth_element(prims.begin() + start, prims.begin() + mid, prims.begin() + end,
+        [axis](const bvh_primitive& a, const bvh_primitive& b) { return a.centroid[axis] < b.centroid[axis]; });
+    return bvh_partition_cost(prims, start, mid, end, options);
+}
 
-    box = surrounding_box(box_left, box_right);
+// Called once on the whole primitive array before building.
+inline void bvh_prepare_primitives(std::vector<bvh_primitive>& prims, const bvh_build_options& options)
+{
+    if (options.builder == bvh_builder::lbvh) bvh_morton_sort(prims, options.morton_bits);
+}
+
+// Splits prims[start,end), a node at the given depth, with the method options select.
+// Either method may peel off as little as one primitive per level, as the LBVH does for
+// points strung out at 2^-i towards a cluster, so a range that could no longer finish
+// within bvh_max_depth that way is halved instead. Halving finishes it in log2(span)
+// levels, and its halves keep being halved, so no leaf ends up deeper than bvh_max_depth.
+inline double bvh_split(std::vector<bvh_primitive>& prims, size_t start, size_t end, int depth,
+                        const bvh_build_options& options, int& axis, size_t& mid)
+{
+    int levels = 0;
+    while ((size_t(1) << levels) < end - start) levels++;
+    if (depth + levels >= bvh_max_depth) return bvh_median_split(prims, start, end, options, axis, mid);
+
+    if (options.builder == bvh_builder::lbvh) return bvh_morton_split(prims, start, end, options, axis, mid);
+    return bvh_sah_split(prims, start, end, options, axis, mid);
+}
+
+class bvh_node : public hittable 
+{
+    public:
+        bvh_node();
+
+        bvh_node(hittable_list& list, double time0, double time1,
+                 const bvh_build_options& options = bvh_build_options())
+            : bvh_node(list.objects, 0, list.objects.size(), time0, time1, options) {}
+
+        bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, double time0, double time1,
+                 const bvh_build_options& options = bvh_build_options());
+
+        // Builds the tree over prims[start,end), rooted at the given depth. The two halves of a
+        // split are built concurrently while more than one task remains, each half taking part
+        // of the tasks along.
+        bvh_node(std::vector<bvh_primitive>& prims, size_t start, size_t end, const bvh_build_options& options,
+                 int tasks = 1, int depth = 0);
+
+        virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+
+        virtual bool bounding_box(double t0, double t1, aabb& output_box) const override;
+
+        virtual void collect_lights(std::vector<shared_ptr<hittable>>& lights) const override;
+
+        // Expected cost of tracing a ray that hits the root box, under the SAH cost model.
+        double sah_cost(const bvh_build_options& options = bvh_build_options()) const;
+
+        // Recomputes every box bottom-up from the objects' current bounds, keeping the tree.
+        void refit(double time0, double time1);
+
+        // Builds a new tree over the same objects.
+        void rebuild(double time0, double time1, const bvh_build_options& options = bvh_build_options());
+
+        // Appends every object below this node.
+        void collect_objects(std::vector<shared_ptr<hittable>>& out) const;
+
+        bool is_leaf() const { return !left; }
+
+    public:
+        shared_ptr<hittable> left;      // interior children, null in a leaf
+        shared_ptr<hittable> right;
+        std::vector<shared_ptr<hittable>> objects;  // primitives of a leaf
+        aabb box;
+        int axis = 0;   // split axis; left holds the objects with smaller centroids
+        double built_cost = 0;  // root only: SAH cost right after the last build
+        bool root = false;      // the node a traversal starts from
+        bool left_object = false;   // the child is a single object rather than a node
+        bool right_object = false;
+};
+
+bvh_node::bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, 
+        double time0, double time1, const bvh_build_options& options)
+{
+    auto prims = make_bvh_primitives(objects, start, end, time0, time1);
+    bvh_prepare_primitives(prims, options);
+    *this = bvh_node(prims, 0, prims.size(), options, bvh_build_tasks(options));
+    built_cost = sah_cost(options);
+    root = true;
+}
+
+bvh_node::bvh_node(std::vector<bvh_primitive>& prims, size_t start, size_t end, const bvh_build_options& options,
+                   int tasks, int depth)
+{
+    size_t mid = end;
+    double split_cost = (end - start > 1) ? bvh_split(prims, start, end, depth, options, axis, mid) : 0.0;
+
+    // Boxes are gathered bottom-up, so each primitive's box is looked at once.
+    box = aabb::empty();
+    if (bvh_make_leaf(end - start, split_cost, options)) {
+        for (size_t i = start; i < end; i++) {
+            objects.push_back(prims[i].object);
+            box = surrounding_box(box, prims[i].box);
+        }
+        return;
+    }
+
+    // A side holding a single object points straight at it instead of at a one-object leaf.
+    auto child = [&](size_t s, size_t e, int t, aabb& child_box) -> shared_ptr<hittable> {
+        if (e - s == 1) {
+            child_box = prims[s].box;
+            return prims[s].object;
+        }
+        auto node = make_shared<bvh_node>(prims, s, e, options, t, depth + 1);
+        child_box = node->box;
+        return node;
+    };
+
+    // The halves cover disjoint ranges of prims, so they can be partitioned independently.
+    aabb left_box, right_box;
+    left_object = mid - start == 1;
+    right_object = end - mid == 1;
+    if (tasks > 1 && end - start >= bvh_parallel_min_span) {
+        auto right_task = std::async(std::launch::async, child, mid, end, tasks / 2, std::ref(right_box));
+        left = child(start, mid, tasks - tasks / 2, left_box);
+        right = right_task.get();
+    }
+    else {
+        left = child(start, mid, 1, left_box);
+        right = child(mid, end, 1, right_box);
+    }
+    box = surrounding_box(left_box, right_box);
 }
 
 bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
 {
+    RT_BVH_COUNT(traversals, root);
+    RT_BVH_COUNT(box_tests, 1);
+    if (!box.hit(r, t_min, t_max)) return false;
+    RT_BVH_COUNT(nodes_visited, 1);
+
+    if (is_leaf()) {
+        RT_BVH_COUNT(primitive_tests, objects.size());
+        bool hit_anything = false;
+        for (const auto& object : objects) {
+            if (object->hit(r, t_min, t_max, rec)) {
+                hit_anything = true;
+                t_max = rec.t;
+            }
+        }
+        return hit_anything;
+    }
+
+    // Visit the child nearer along the ray first. Once it reports a hit, the far child's
+    // own box test runs against the shortened interval and usually fails at once.
+    const auto& near = r.direction()[axis] < 0 ? right : left;
+    const auto& far  = r.direction()[axis] < 0 ? left : right;
+    RT_BVH_COUNT(primitive_tests, left_object + right_object);
+
+    bool hit_near = near->hit(r, t_min, t_max, rec);
+    bool hit_far  = far ->hit(r, t_min, hit_near ? rec.t : t_max, rec);
+
+    return hit_near || hit_far;
+}
+
+bool bvh_node::occluded(const ray& r, double t_min, double t_max) const
+{
+    RT_BVH_COUNT(traversals, root);
+    RT_BVH_COUNT(box_tests, 1);
     if (!box.hit(r, t_min, t_max)) return false;
+    RT_BVH_COUNT(nodes_visited, 1);
 
-    bool hit_left  = left ->hit(r, t_min, t_max,                    rec);
-    bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+    if (is_leaf()) {
+        for (const auto& object : objects) {
+            RT_BVH_COUNT(primitive_tests, 1);
+            if (object->occluded(r, t_min, t_max)) return true;
+        }
+        return false;
+    }
 
-    return hit_left || hit_right;
+    // Any blocker will do, so there is no point in ordering the children.
+    RT_BVH_COUNT(primitive_tests, left_object);
+    if (left->occluded(r, t_min, t_max)) return true;
+    RT_BVH_COUNT(primitive_tests, right_object);
+    return right->occluded(r, t_min, t_max);
 }
 
 bool bvh_node::bounding_box(double t0, double t1, aabb& output_box) const 
@@ -101,4 +471,63 @@ bool bvh_node::bounding_box(double t0, double t1, aabb& output_box) const
     return true;
 }
 
+double bvh_node::sah_cost(const bvh_build_options& options) const
+{
+    auto child_cost = [&](const shared_ptr<hittable>& child, bool object) {
+        if (object) return options.intersection_cost;
+
+        auto node = static_cast<const bvh_node*>(child.get());
+        return bvh_area_ratio(node->box.surface_area(), box.surface_area()) * node->sah_cost(options);
+    };
+
+    if (is_leaf()) return options.traversal_cost + options.intersection_cost * objects.size();
+    return options.traversal_cost + child_cost(left, left_object) + child_cost(right, right_object);
+}
+
+// Only the nodes of this tree are visited. An object, including a BVH built on its own and
+// linked in as one, is taken as it is.
+void bvh_node::refit(double time0, double time1)
+{
+    if (is_leaf()) {
+        box = aabb::empty();
+        for (const auto& object : objects) {
+            aabb object_box;
+            if (object->bounding_box(time0, time1, object_box)) box = surrounding_box(box, object_box);
+        }
+        return;
+    }
+
+    aabb left_box, right_box;
+    if (!left_object) static_cast<bvh_node*>(left.get())->refit(time0, time1);
+    if (!right_object) static_cast<bvh_node*>(right.get())->refit(time0, time1);
+    if (!left->bounding_box(time0, time1, left_box)) left_box = aabb::empty();
+    if (!right->bounding_box(time0, time1, right_box)) right_box = aabb::empty();
+    box = surrounding_box(left_box, right_box);
+}
+
+void bvh_node::rebuild(double time0, double time1, const bvh_build_options& options)
+{
+    std::vector<shared_ptr<hittable>> all;
+    collect_objects(all);
+    *this = bvh_node(all, 0, all.size(), time0, time1, options);
+}
+
+void bvh_node::collect_objects(std::vector<shared_ptr<hittable>>& out) const
+{
+    if (is_leaf()) {
+        out.insert(out.end(), objects.begin(), objects.end());
+        return;
+    }
+    // A separate BVH linked in as an object stays whole.
+    if (left_object) out.push_back(left);
+    else static_cast<const bvh_node*>(left.get())->collect_objects(out);
+    if (right_object) out.push_back(right);
+    else static_cast<const bvh_node*>(right.get())->collect_objects(out);
+}
+
+void bvh_node::collect_lights(std::vector<shared_ptr<hittable>>& lights) const
+{
+    collect_emitters(is_leaf() ? objects : std::vector<shared_ptr<hittable>>{left, right}, lights);
+}
+
 #endif
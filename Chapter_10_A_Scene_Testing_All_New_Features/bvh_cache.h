@@ -0,0 +1,228 @@
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "linear_bvh.h"
+
+// On-disk form of a linear_bvh. The nodes are already index-based and position
+// independent, so they are stored as they are in memory. The primitives are stored as
+// their indices in the hittable_list the tree was built from. The file is keyed by a hash
+// of everything the build depends on, so a file written for other objects or other
+// settings is never used.
+//
+//     header | nodes (32 bytes each) | primitive indices (uint32 each)
+
+const char bvh_cache_magic[8] = {'R','T','B','V','H','0','0','1'};
+
+struct bvh_cache_header
+{
+    char magic[8];
+    uint64_t key;
+    uint64_t node_count;
+    uint64_t primitive_count;
+    double box[2][3];
+};
+
+// Hash of the objects' bounding boxes, in list order, together with the shutter interval
+// and build options. Those are all the builder looks at, so equal keys give equal trees.
+uint64_t bvh_cache_key(const hittable_list& list, double time0, double time1, const bvh_build_options& options)
+{
+    uint64_t key = hash64(list.objects.size());
+    auto mix = [&key](double x) {
+        uint64_t bits;
+        std::memcpy(&bits, &x, sizeof(bits));
+        key = hash64(key ^ bits) + 0x9e3779b97f4a7c15ull;
+    };
+
+    mix(time0);
+    mix(time1);
+    mix(options.bins);
+    mix(options.traversal_cost);
+    mix(options.intersection_cost);
+    mix(options.max_leaf_size);
+    mix(static_cast<int>(options.builder));
+    mix(options.morton_bits);
+
+    for (const auto& object : list.objects) {
+        aabb b;
+        if (!object->bounding_box(time0, time1, b)) b = aabb::empty();
+        for (int a = 0; a < 3; a++) {
+            mix(b.min()[a]);
+            mix(b.max()[a]);
+        }
+    }
+    return key;
+}
+
+// Writes bvh, built from list, under key. Returns false if the file can't be written.
+bool save_bvh_cache(const std::string& filename, uint64_t key, const hittable_list& list, const linear_bvh& bvh)
+{
+    std::unordered_map<const hittable*, uint32_t> index;
+    for (size_t i = 0; i < list.objects.size(); i++) index.emplace(list.objects[i].get(), static_cast<uint32_t>(i));
+
+    std::vector<uint32_t> order(bvh.primitives.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        auto it = index.find(bvh.primitives[i].get());
+        if (it == index.end()) return false;
+        order[i] = it->second;
+    }
+
+    bvh_cache_header header;
+    std::memcpy(header.magic, bvh_cache_magic, sizeof(header.magic));
+    header.key = key;
+    header.node_count = bvh.nodes.size();
+    header.primitive_count = order.size();
+    for (int a = 0; a < 3; a++) {
+        header.box[0][a] = bvh.box.min()[a];
+        header.box[1][a] = bvh.box.max()[a];
+    }
+
+    // Written aside and renamed into place, like checkpoints, so a reader never maps a
+    // half-written file, and a tree still using the old file keeps its mapping.
+    auto temp_name = filename + ".tmp";
+    {
+        std::ofstream out(temp_name, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(bvh.nodes.data()), bvh.nodes.size()*sizeof(linear_bvh_node));
+        out.write(reinterpret_cast<const char*>(order.data()), order.size()*sizeof(uint32_t));
+        if (!out) return false;
+    }
+    return std::rename(temp_name.c_str(), filename.c_str()) == 0;
+}
+
+// The file's bytes: mapped read-only where the platform allows it, so that loading costs
+// only the page faults of the pages traversal touches, and read into a buffer otherwise.
+// A loaded tree's nodes point into it, so it lives as long as the tree does.
+class bvh_cache_file
+{
+    public:
+        bvh_cache_file(const std::string& filename)
+        {
+#if defined(__unix__) || defined(__APPLE__)
+            int fd = open(filename.c_str(), O_RDONLY);
+            if (fd < 0) return;
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED) {
+                    mapped = p;
+                    bytes = static_cast<const char*>(p);
+                    length = static_cast<size_t>(st.st_size);
+                }
+            }
+            close(fd);
+#else
+            std::ifstream in(filename, std::ios::binary);
+            buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            bytes = buffer.data();
+            length = buffer.size();
+#endif
+        }
+
+        ~bvh_cache_file()
+        {
+#if defined(__unix__) || defined(__APPLE__)
+            if (mapped) munmap(mapped, length);
+#endif
+        }
+
+        bvh_cache_file(const bvh_cache_file&) = delete;
+        bvh_cache_file& operator=(const bvh_cache_file&) = delete;
+
+    public:
+        const char* bytes = nullptr;
+        size_t length = 0;
+
+    private:
+        void* mapped = nullptr;
+        std::vector<char> buffer;
+};
+
+// True if the nodes form a tree the traversal can walk safely: every interior node's
+// children lie after it inside the array, and every leaf's primitives inside the
+// primitive array. Children after their parent also rule out cycles.
+bool bvh_cache_nodes_valid(const linear_bvh_node* nodes, uint64_t node_count, uint64_t primitive_count)
+{
+    for (uint64_t i = 0; i < node_count; i++) {
+        const auto& node = nodes[i];
+        if (node.is_leaf()) {
+            if (uint64_t(node.offset) + node.count > primitive_count) return false;
+        } else {
+            if (node.axis > 2 || i + 1 >= node_count || node.offset <= i + 1 || node.offset >= node_count)
+                return false;
+        }
+    }
+    return true;
+}
+
+// Loads the tree stored under key for list into bvh. Returns false, leaving bvh alone,
+// when there is no such file or it was written for something else. The tree's nodes are
+// not copied: bvh traverses them where they lie in the mapped file.
+bool load_bvh_cache(const std::string& filename, uint64_t key, const hittable_list& list,
+                    const bvh_build_options& options, linear_bvh& bvh)
+{
+    auto file = std::make_shared<bvh_cache_file>(filename);
+    if (file->length < sizeof(bvh_cache_header)) return false;
+
+    bvh_cache_header header;
+    std::memcpy(&header, file->bytes, sizeof(header));
+    if (std::memcmp(header.magic, bvh_cache_magic, sizeof(header.magic)) != 0 || header.key != key)
+        return false;
+
+    // The key covers the object count, so this only fails for a damaged file, and it keeps
+    // the sizes below from coming from one.
+    if (header.primitive_count != list.objects.size() || header.node_count > 2*header.primitive_count
+        || (header.node_count == 0) != (header.primitive_count == 0)) {
+        std::cerr << "ERROR: BVH cache '" << filename << "' doesn't match the scene.\n";
+        return false;
+    }
+
+    auto nodes_size = header.node_count * sizeof(linear_bvh_node);
+    auto order_size = header.primitive_count * sizeof(uint32_t);
+    if (file->length != sizeof(header) + nodes_size + order_size) {
+        std::cerr << "ERROR: BVH cache '" << filename << "' is truncated.\n";
+        return false;
+    }
+
+    // The header is a multiple of the nodes' alignment, and the mapping is page aligned.
+    static_assert(sizeof(bvh_cache_header) % alignof(linear_bvh_node) == 0, "nodes must stay aligned");
+    auto nodes = reinterpret_cast<const linear_bvh_node*>(file->bytes + sizeof(header));
+    if (!bvh_cache_nodes_valid(nodes, header.node_count, header.primitive_count)) {
+        std::cerr << "ERROR: BVH cache '" << filename << "' has out-of-range nodes.\n";
+        return false;
+    }
+
+    const char* order = file->bytes + sizeof(header) + nodes_size;
+    std::vector<shared_ptr<hittable>> primitives(header.primitive_count);
+    for (size_t i = 0; i < primitives.size(); i++) {
+        uint32_t index;
+        std::memcpy(&index, order + i*sizeof(index), sizeof(index));
+        if (index >= list.objects.size()) return false;
+        primitives[i] = list.objects[index];
+    }
+
+    bvh.nodes.map(file, nodes, header.node_count);
+    bvh.primitives = std::move(primitives);
+    bvh.box = aabb(point3(header.box[0][0], header.box[0][1], header.box[0][2]),
+                   point3(header.box[1][0], header.box[1][1], header.box[1][2]));
+    bvh.built_cost = bvh.sah_cost(options);
+    return true;
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef BVH_CHECK_H
+#define BVH_CHECK_H
+
+#include <cmath>
+#include <iostream>
+
+#include "accel.h"
+
+// Builds list into every layout and traces `rays` random rays through its box against
+// each, comparing hit() and occluded() with a plain walk over the list. Every layout must
+// find the same closest hit, and occluded() must agree with it. Reports the layouts that
+// disagree on out and returns the number of disagreeing rays over all of them. The
+// traversals aren't part of any render, so they are kept out of the thread's BVH counters.
+size_t bvh_check_layouts(hittable_list& list, double time0, double time1, int rays,
+                         const bvh_build_options& options, std::ostream& out)
+{
+    aabb box;
+    if (list.objects.empty() || !list.bounding_box(time0, time1, box)) return 0;
+    auto margin = 0.1 * (box.max() - box.min()) + vec3(1e-3, 1e-3, 1e-3);
+    auto lo = box.min() - margin;
+    auto size = box.max() - box.min() + 2 * margin;
+
+    const bvh_layout layouts[] = { bvh_layout::binary, bvh_layout::linear, bvh_layout::bvh4,
+                                   bvh_layout::bvh8, bvh_layout::motion };
+    const char* names[] = { "binary", "linear", "bvh4", "bvh8", "motion" };
+
+    auto counters = thread_bvh_counters();
+    size_t failures = 0;
+    for (int l = 0; l < 5; l++) {
+        auto bvh = make_bvh(list, time0, time1, layouts[l], options);
+        size_t wrong_hit = 0, wrong_occluded = 0;
+        for (int i = 0; i < rays; i++) {
+            point3 origin(lo.x() + random_double() * size.x(), lo.y() + random_double() * size.y(),
+                          lo.z() + random_double() * size.z());
+            ray r(origin, random_unit_vector(), random_double(time0, time1));
+            // Half the rays are segments ending inside the box, as shadow rays do.
+            double t_max = (i & 1) ? random_double(0, size.length()) : infinity;
+
+            hit_record expected, found;
+            bool hit = list.hit(r, 0.001, t_max, expected);
+            bool bvh_hit = bvh->hit(r, 0.001, t_max, found);
+            if (hit != bvh_hit || (hit && fabs(found.t - expected.t) > 1e-9 * fmax(1.0, expected.t)))
+                wrong_hit++;
+            if (bvh->occluded(r, 0.001, t_max) != hit) wrong_occluded++;
+        }
+
+        if (wrong_hit || wrong_occluded)
+            out << "BVH check: " << names[l] << " layout disagrees with the object list on " << wrong_hit
+                << " hit() and " << wrong_occluded << " occluded() of " << rays << " rays\n";
+        failures += wrong_hit + wrong_occluded;
+    }
+    if (!failures) out << "BVH check: all layouts agree with the object list on " << rays << " rays\n";
+    thread_bvh_counters() = counters;
+    return failures;
+}
+
+#endif
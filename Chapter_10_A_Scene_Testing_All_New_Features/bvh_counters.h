@@ -0,0 +1,55 @@
+#ifndef BVH_COUNTERS_H
+#define BVH_COUNTERS_H
+
+#include <cstdint>
+#include <iostream>
+
+// Work done by BVH traversals. Each thread counts into its own copy, and the renderer
+// collects them tile by tile, like path_statistics. The counting is compiled in only when
+// RT_BVH_STATS is defined; otherwise RT_BVH_COUNT expands to nothing and traversal is
+// untouched.
+struct bvh_counters
+{
+    uint64_t traversals = 0;        // hit() calls on a BVH; a nested BVH counts again
+    uint64_t nodes_visited = 0;
+    uint64_t box_tests = 0;
+    uint64_t primitive_tests = 0;
+
+    void merge(const bvh_counters& other)
+    {
+        traversals += other.traversals;
+        nodes_visited += other.nodes_visited;
+        box_tests += other.box_tests;
+        primitive_tests += other.primitive_tests;
+    }
+
+    // Returns the counts so far and starts again from zero.
+    bvh_counters take()
+    {
+        auto counts = *this;
+        *this = bvh_counters();
+        return counts;
+    }
+
+    void print(std::ostream& out) const
+    {
+        auto per = [this](uint64_t n) { return traversals ? double(n) / traversals : 0.0; };
+        out << "BVH traversals: " << traversals << ", per traversal: "
+            << per(nodes_visited) << " nodes visited, " << per(box_tests) << " box tests, "
+            << per(primitive_tests) << " primitive tests\n";
+    }
+};
+
+inline bvh_counters& thread_bvh_counters()
+{
+    thread_local bvh_counters counters;
+    return counters;
+}
+
+#ifdef RT_BVH_STATS
+#define RT_BVH_COUNT(field, n) (thread_bvh_counters().field += (n))
+#else
+#define RT_BVH_COUNT(field, n) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef BVH_STATS_H
+#define BVH_STATS_H
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "accel.h"
+
+// Shape and quality of a built tree. Overlap is measured per interior node as the
+// surface area shared by pairs of its children relative to the node's own area, and
+// averaged over the interior nodes: the more children overlap, the more of them a ray
+// through the shared region has to enter.
+struct bvh_tree_stats
+{
+    size_t interior_nodes = 0;
+    size_t leaves = 0;
+    size_t primitives = 0;
+    int max_depth = 0;
+    double leaf_depth_sum = 0;
+    size_t leaf_sizes[9] = {};  // leaves holding 1 to 8 primitives; larger ones count at 8
+    double overlap_sum = 0;
+    size_t overlap_nodes = 0;   // interior nodes the overlap is averaged over
+    double sah_cost = 0;
+
+    void add_leaf(int depth, size_t count)
+    {
+        leaves++;
+        primitives += count;
+        max_depth = std::max(max_depth, depth);
+        leaf_depth_sum += depth;
+        leaf_sizes[std::min<size_t>(count, 8)]++;
+    }
+
+    // Adds an interior node with the given child boxes. A node whose area or overlap can't
+    // be represented is left out of the overlap average rather than making it NaN.
+    void add_interior(const aabb& node_box, const aabb* children, int count)
+    {
+        interior_nodes++;
+        auto area = node_box.surface_area();
+        if (!std::isfinite(area) || !(area > 0)) return;
+
+        double overlap = 0;
+        for (int a = 0; a < count; a++)
+            for (int b = a + 1; b < count; b++)
+                overlap += overlap_area(children[a], children[b]) / area;
+        if (!std::isfinite(overlap)) return;
+        overlap_sum += overlap;
+        overlap_nodes++;
+    }
+
+    static double overlap_area(const aabb& a, const aabb& b)
+    {
+        point3 lo, hi;
+        for (int k = 0; k < 3; k++) {
+            lo[k] = fmax(a.min()[k], b.min()[k]);
+            hi[k] = fmin(a.max()[k], b.max()[k]);
+            if (lo[k] > hi[k]) return 0.0;
+        }
+        return aabb(lo, hi).surface_area();
+    }
+
+    void print(std::ostream& out, const char* name) const
+    {
+        out << name << " BVH: " << interior_nodes << " interior nodes, " << leaves << " leaves, "
+            << primitives << " primitives, depth " << max_depth << " (leaf average "
+            << (leaves ? leaf_depth_sum / leaves : 0.0) << "), SAH cost " << sah_cost
+            << ", overlap " << (overlap_nodes ? overlap_sum / overlap_nodes : 0.0) << '\n';
+        out << "    leaf sizes:";
+        for (int k = 1; k <= 8; k++) out << ' ' << k << (k == 8 ? "+" : "") << ':' << leaf_sizes[k];
+        out << '\n';
+    }
+};
+
+void collect_bvh_stats(const bvh_node& node, int depth, bvh_tree_stats& stats)
+{
+    if (node.is_leaf()) {
+        stats.add_leaf(depth, node.objects.size());
+        return;
+    }
+
+    aabb children[2];
+    int k = 0;
+    for (const auto& child : {node.left, node.right}) {
+        child->bounding_box(0, 0, children[k++]);
+        // A single object is linked straight in; a separate BVH among the objects counts as one.
+        auto child_node = dynamic_cast<const bvh_node*>(child.get());
+        if (child_node && !child_node->root) collect_bvh_stats(*child_node, depth + 1, stats);
+        else stats.add_leaf(depth + 1, 1);
+    }
+    stats.add_interior(node.box, children, 2);
+}
+
+// Box of a flattened node; for the motion layout, at the middle of the shutter interval.
+inline aabb stats_node_box(const linear_bvh_node& node)
+{
+    return aabb(point3(node.bounds[0][0], node.bounds[0][1], node.bounds[0][2]),
+                point3(node.bounds[1][0], node.bounds[1][1], node.bounds[1][2]));
+}
+
+inline aabb stats_node_box(const motion_bvh_node& node)
+{
+    point3 lo, hi;
+    for (int a = 0; a < 3; a++) {
+        lo[a] = 0.5 * (double(node.bounds[0][0][a]) + node.bounds[1][0][a]);
+        hi[a] = 0.5 * (double(node.bounds[0][1][a]) + node.bounds[1][1][a]);
+    }
+    return aabb(lo, hi);
+}
+
+template <typename node_type>
+void collect_bvh_stats(const node_type* nodes, uint32_t index, int depth, bvh_tree_stats& stats)
+{
+    const auto& node = nodes[index];
+    if (node.is_leaf()) {
+        stats.add_leaf(depth, node.count);
+        return;
+    }
+
+    aabb children[2] = { stats_node_box(nodes[index + 1]), stats_node_box(nodes[node.offset]) };
+    stats.add_interior(stats_node_box(node), children, 2);
+    collect_bvh_stats(nodes, index + 1, depth + 1, stats);
+    collect_bvh_stats(nodes, node.offset, depth + 1, stats);
+}
+
+template <int N>
+void collect_bvh_stats(const wide_bvh<N>& bvh, uint32_t index, int depth, bvh_tree_stats& stats)
+{
+    const auto& node = bvh.nodes[index];
+    aabb children[N];
+    auto node_box = aabb::empty();
+    int count = 0;
+    for (int k = 0; k < node.children; k++) {
+        children[count] = aabb(point3(node.bounds[0][0][k], node.bounds[0][1][k], node.bounds[0][2][k]),
+                               point3(node.bounds[1][0][k], node.bounds[1][1][k], node.bounds[1][2][k]));
+        node_box = surrounding_box(node_box, children[count++]);
+
+        if (node.count[k] > 0) stats.add_leaf(depth + 1, node.count[k]);
+        else collect_bvh_stats(bvh, node.child[k], depth + 1, stats);
+    }
+    stats.add_interior(node_box, children, count);
+}
+
+// Statistics of a tree made by make_bvh(); all zero for anything else.
+bvh_tree_stats bvh_statistics(const hittable& object, const bvh_build_options& options = bvh_build_options())
+{
+    bvh_tree_stats stats;
+    if (auto p = dynamic_cast<const bvh_node*>(&object)) collect_bvh_stats(*p, 0, stats);
+    else if (auto p = dynamic_cast<const linear_bvh*>(&object)) {
+        if (!p->nodes.empty()) collect_bvh_stats(p->nodes.data(), 0, 0, stats);
+    }
+    else if (auto p = dynamic_cast<const motion_bvh*>(&object)) {
+        if (!p->nodes.empty()) collect_bvh_stats(p->nodes.data(), 0, 0, stats);
+    }
+    else if (auto p = dynamic_cast<const bvh4*>(&object)) {
+        if (!p->nodes.empty()) collect_bvh_stats(*p, 0, 0, stats);
+    }
+    else if (auto p = dynamic_cast<const bvh8*>(&object)) {
+        if (!p->nodes.empty()) collect_bvh_stats(*p, 0, 0, stats);
+    }
+    stats.sah_cost = bvh_sah_cost(object, options);
+    return stats;
+}
+
+#endif
@@ -35,6 +35,8 @@ class camera {
             time1 = t1;
         }
 
+        // After the two pixel dimensions the camera always draws two for the lens and one
+        // for the time, so each lands on the same sampler dimension in every sample.
         ray get_ray(double s, double t) const {
             vec3 rd = lens_radius * random_in_unit_disk();
             vec3 offset = u * rd.x() + v * rd.y();
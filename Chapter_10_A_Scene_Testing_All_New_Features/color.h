@@ -2,10 +2,15 @@
 #define COLOR_H
 
 #include <iostream>
-#include <vector>
 
 #include "rtweekend.h"
 
+// Relative luminance of a linear RGB color (Rec. 709 weights)
+inline double luminance(const color& c)
+{
+    return 0.2126*c.x() + 0.7152*c.y() + 0.0722*c.z();
+}
+
 void write_color(std::ostream & out, color pixel_color, int samples_per_pixel) 
 {
     auto r = pixel_color.x();
@@ -24,21 +29,23 @@ void write_color(std::ostream & out, color pixel_color, int samples_per_pixel)
         << static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
 }
 
-std::vector<int> write_color(color pixel_color, int samples_per_pixel)
+// Same conversion into three bytes, for image buffers
+void write_color(unsigned char* out, color pixel_color, int samples_per_pixel)
 {
     auto r = pixel_color.x();
     auto g = pixel_color.y();
     auto b = pixel_color.z();
 
-    // Divide the color by the number of samples and gamma-correct for gamma=2.0
-    auto scale = 1.0 / samples_per_pixel;
+    // Divide the color by the number of samples and gamma-correct for gamma=2.0.
+    // A pixel without samples stays black.
+    auto scale = samples_per_pixel > 0 ? 1.0 / samples_per_pixel : 0.0;
     r = sqrt(scale * r);
     g = sqrt(scale * g);
     b = sqrt(scale * b);
 
-    // Write the translated [0,255] value of each color component
-    return {static_cast<int>(256 * clamp(r, 0.0, 0.999)), 
-        static_cast<int>(256 * clamp(g, 0.0, 0.999)), static_cast<int>(256 * clamp(b, 0.0, 0.999))};
+    out[0] = static_cast<unsigned char>(256 * clamp(r, 0.0, 0.999));
+    out[1] = static_cast<unsigned char>(256 * clamp(g, 0.0, 0.999));
+    out[2] = static_cast<unsigned char>(256 * clamp(b, 0.0, 0.999));
 }
 
 #endif
@@ -0,0 +1,167 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "color.h"
+
+// Accumulates radiance for every pixel in one contiguous RGB array, together with the
+// number of samples each pixel has received and the sum of their squared luminance, from
+// which the adaptive sampler estimates the pixel's noise. Pixel (i,j) follows the render
+// loop: j = 0 is the bottom row.
+class framebuffer
+{
+    public:
+        framebuffer(int w, int h)
+            : image_width(w), image_height(h), accum(3*size_t(w)*h, 0.0),
+              accum_sq(size_t(w)*h, 0.0), counts(size_t(w)*h, 0) {}
+
+        int width() const { return image_width; }
+        int height() const { return image_height; }
+
+        void add_sample(int i, int j, const color& c)
+        {
+            auto l = luminance(c);
+            add_samples(i, j, c, l*l, 1);
+        }
+
+        // Adds `n` samples whose radiance sums to `sum` and whose squared luminance sums
+        // to `sum_sq`.
+        void add_samples(int i, int j, const color& sum, double sum_sq, uint32_t n)
+        {
+            auto k = index(i, j);
+            accum[3*k]   += sum.x();
+            accum[3*k+1] += sum.y();
+            accum[3*k+2] += sum.z();
+            accum_sq[k] += sum_sq;
+            counts[k] += n;
+        }
+
+        color sum(int i, int j) const
+        {
+            auto k = index(i, j);
+            return color(accum[3*k], accum[3*k+1], accum[3*k+2]);
+        }
+
+        uint32_t sample_count(int i, int j) const { return counts[index(i, j)]; }
+
+        uint32_t min_sample_count() const { return *std::min_element(counts.begin(), counts.end()); }
+
+        double average_sample_count() const
+        {
+            double total = 0;
+            for (auto n : counts) total += n;
+            return total / counts.size();
+        }
+
+        // Standard error of the pixel's mean luminance relative to the mean itself. Dark
+        // pixels are measured against a floor so they can converge at all.
+        double relative_error(int i, int j) const
+        {
+            auto k = index(i, j);
+            auto n = counts[k];
+            if (n < 2) return infinity;
+
+            auto mean = luminance(sum(i, j)) / n;
+            auto variance = std::max(0.0, (accum_sq[k] - n*mean*mean) / (n - 1));
+            return sqrt(variance / n) / std::max(mean, 1e-3);
+        }
+
+        // Adds the samples of another buffer of the same size, e.g. a render of other
+        // sample indices.
+        void merge(const framebuffer& other)
+        {
+            for (size_t k = 0; k < accum.size(); k++) accum[k] += other.accum[k];
+            for (size_t k = 0; k < accum_sq.size(); k++) accum_sq[k] += other.accum_sq[k];
+            for (size_t k = 0; k < counts.size(); k++) counts[k] += other.counts[k];
+        }
+
+        // Tonemaps the averages into 8-bit RGB, rows from top to bottom.
+        std::vector<unsigned char> to_rgb8() const
+        {
+            std::vector<unsigned char> out(3*counts.size());
+            auto p = out.data();
+            for (int j = image_height-1; j >= 0; --j)
+                for (int i = 0; i < image_width; ++i, p += 3)
+                    write_color(p, sum(i, j), sample_count(i, j));
+            return out;
+        }
+
+        // Checkpoints hold the raw sums and counts, so a resumed render carries on exactly
+        // where the saved one stopped. `tag` identifies the render (scene, seed, ...) and
+        // must match on load.
+        bool save(const std::string& filename, uint64_t tag) const;
+        bool load(const std::string& filename, uint64_t tag);
+
+    private:
+        size_t index(int i, int j) const { return size_t(j)*image_width + i; }
+
+    private:
+        int image_width;
+        int image_height;
+        std::vector<double> accum;
+        std::vector<double> accum_sq;
+        std::vector<uint32_t> counts;
+};
+
+const char checkpoint_magic[8] = {'R','T','F','B','U','F','0','2'};
+
+bool framebuffer::save(const std::string& filename, uint64_t tag) const
+{
+    // Write next to the old checkpoint and swap it in, so a crash mid-write never leaves
+    // us without a usable file.
+    auto temp_name = filename + ".tmp";
+    {
+        std::ofstream out(temp_name, std::ios::binary);
+        int32_t size[2] = { image_width, image_height };
+        out.write(checkpoint_magic, sizeof(checkpoint_magic));
+        out.write(reinterpret_cast<const char*>(&tag), sizeof(tag));
+        out.write(reinterpret_cast<const char*>(size), sizeof(size));
+        out.write(reinterpret_cast<const char*>(accum.data()), accum.size()*sizeof(double));
+        out.write(reinterpret_cast<const char*>(accum_sq.data()), accum_sq.size()*sizeof(double));
+        out.write(reinterpret_cast<const char*>(counts.data()), counts.size()*sizeof(uint32_t));
+        if (!out) return false;
+    }
+    return std::rename(temp_name.c_str(), filename.c_str()) == 0;
+}
+
+bool framebuffer::load(const std::string& filename, uint64_t tag)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        std::cerr << "ERROR: Could not open checkpoint '" << filename << "'.\n";
+        return false;
+    }
+
+    char magic[sizeof(checkpoint_magic)];
+    uint64_t file_tag;
+    int32_t size[2];
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char*>(&file_tag), sizeof(file_tag));
+    in.read(reinterpret_cast<char*>(size), sizeof(size));
+
+    if (!in || !std::equal(magic, magic + sizeof(magic), checkpoint_magic)
+            || file_tag != tag || size[0] != image_width || size[1] != image_height) {
+        std::cerr << "ERROR: Checkpoint '" << filename << "' does not match this render.\n";
+        return false;
+    }
+
+    in.read(reinterpret_cast<char*>(accum.data()), accum.size()*sizeof(double));
+    in.read(reinterpret_cast<char*>(accum_sq.data()), accum_sq.size()*sizeof(double));
+    in.read(reinterpret_cast<char*>(counts.data()), counts.size()*sizeof(uint32_t));
+    if (!in) {
+        std::cerr << "ERROR: Checkpoint '" << filename << "' is truncated.\n";
+        std::fill(accum.begin(), accum.end(), 0.0);
+        std::fill(accum_sq.begin(), accum_sq.end(), 0.0);
+        std::fill(counts.begin(), counts.end(), 0);
+        return false;
+    }
+    return true;
+}
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef HITTABLE_H
 #define HITTABLE_H
 
+#include <vector>
+
 #include "aabb.h"
 
 class material;
@@ -27,15 +29,71 @@ class hittable
     public:
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const = 0;
+
+        // Whether anything lies along r within (t_min, t_max). Unlike hit() it may stop at
+        // the first intersection it finds, which is all a shadow ray needs to know.
+        virtual bool occluded(const ray& r, double t_min, double t_max) const
+        {
+            hit_record rec;
+            return hit(r, t_min, t_max, rec);
+        }
+
+        // Light sampling. An emitter that can be sampled returns true from is_emitter(),
+        // picks directions from `o` towards itself with random(), and gives the solid angle
+        // density of such a direction with pdf_value().
+        virtual bool is_emitter() const { return false; }
+        virtual double pdf_value(const point3& /*o*/, const vec3& /*v*/) const { return 0.0; }
+        virtual vec3 random(const point3& /*o*/) const { return vec3(1, 0, 0); }
+
+        // Containers append the emitters they hold, so the renderer can find the lights
+        // of a scene without being told.
+        virtual void collect_lights(std::vector<shared_ptr<hittable>>& /*lights*/) const {}
 };
 
+// collect_lights() of a container holding objects: emitters are appended as they are,
+// anything else is asked for the emitters it holds.
+inline void collect_emitters(const std::vector<shared_ptr<hittable>>& objects,
+                             std::vector<shared_ptr<hittable>>& lights)
+{
+    for (const auto& object : objects) {
+        if (object->is_emitter()) lights.push_back(object);
+        else object->collect_lights(lights);
+    }
+}
+
+// Nearer root within (t_min, t_max) of the intersection of r with a sphere. Both sphere
+// shapes answer hit() and occluded() through it, so the two always agree; a ray that only
+// grazes the sphere misses it.
+inline bool sphere_root(const ray& r, const point3& center, double radius, double t_min, double t_max, double& t)
+{
+    vec3 oc = r.origin() - center;
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c = oc.length_squared() - radius*radius;
+    auto discriminant = half_b*half_b - a*c;
+    if (!(discriminant > 0)) return false;
+
+    auto root = sqrt(discriminant);
+    t = (-half_b - root) / a;
+    if (t < t_max && t > t_min) return true;
+    t = (-half_b + root) / a;
+    return t < t_max && t > t_min;
+}
+
 class translate : public hittable 
 {
     public:
         translate(shared_ptr<hittable> p, const vec3& displacement) : ptr(p), offset(displacement) {}
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const override;
 
+        // An emitter moved by a translate is sampled where it has been moved to.
+        virtual bool is_emitter() const override { return ptr->is_emitter(); }
+        virtual double pdf_value(const point3& o, const vec3& v) const override { return ptr->pdf_value(o - offset, v); }
+        virtual vec3 random(const point3& o) const override { return ptr->random(o - offset); }
+        virtual void collect_lights(std::vector<shared_ptr<hittable>>& lights) const override;
+
     public:
         shared_ptr<hittable> ptr;
         vec3 offset;
@@ -52,6 +110,11 @@ bool translate::hit(const ray& r, double t_min, double t_max, hit_record& rec) c
     return true;
 }
 
+bool translate::occluded(const ray& r, double t_min, double t_max) const
+{
+    return ptr->occluded(ray(r.origin() - offset, r.direction(), r.time()), t_min, t_max);
+}
+
 bool translate::bounding_box(double t0, double t1, aabb& output_box) const 
 {
     if (!ptr->bounding_box(t0, t1, output_box)) return false;
@@ -61,17 +124,48 @@ bool translate::bounding_box(double t0, double t1, aabb& output_box) const
     return true;
 }
 
+// Each emitter inside gets a translate of its own, so the registry samples it in place.
+void translate::collect_lights(std::vector<shared_ptr<hittable>>& lights) const
+{
+    std::vector<shared_ptr<hittable>> inner;
+    ptr->collect_lights(inner);
+    for (const auto& light : inner) lights.push_back(make_shared<translate>(light, offset));
+}
+
 class rotate_y : public hittable 
 {
     public:
         rotate_y(shared_ptr<hittable> p, double angle);
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const override {
             output_box = bbox; return hasbox;
         }
 
+        // Rotation keeps solid angles, so an emitter's densities carry over unchanged.
+        virtual bool is_emitter() const override { return ptr->is_emitter(); }
+        virtual double pdf_value(const point3& o, const vec3& v) const override;
+        virtual vec3 random(const point3& o) const override;
+        virtual void collect_lights(std::vector<shared_ptr<hittable>>& lights) const override;
+
+    private:
+        // A point or direction taken into the object's unrotated frame, and back out of it.
+        // The rotation is about the origin, so points and directions turn alike.
+        vec3 to_object(const vec3& v) const
+        {
+            return vec3(cos_theta*v[0] - sin_theta*v[2], v[1], sin_theta*v[0] + cos_theta*v[2]);
+        }
+        vec3 to_world(const vec3& v) const
+        {
+            return vec3(cos_theta*v[0] + sin_theta*v[2], v[1], -sin_theta*v[0] + cos_theta*v[2]);
+        }
+
+        // The ray in the object's unrotated frame
+        ray rotate_ray(const ray& r) const { return ray(to_object(r.origin()), to_object(r.direction()), r.time()); }
+
     public:
         shared_ptr<hittable> ptr;
+        double angle;   // in degrees
         double sin_theta;
         double cos_theta;
         bool hasbox;
@@ -79,7 +173,7 @@ class rotate_y : public hittable
 };
 
 
-rotate_y::rotate_y(shared_ptr<hittable> p, double angle) : ptr(p) 
+rotate_y::rotate_y(shared_ptr<hittable> p, double angle) : ptr(p), angle(angle)
 {
     auto radians = degrees_to_radians(angle);
     sin_theta = sin(radians);
@@ -109,34 +203,38 @@ rotate_y::rotate_y(shared_ptr<hittable> p, double angle) : ptr(p)
 }
 
 
-bool rotate_y::hit(const ray& r, double t_min, double t_max, hit_record& rec) const 
+bool rotate_y::occluded(const ray& r, double t_min, double t_max) const
 {
-    point3 origin = r.origin();
-    vec3 direction = r.direction();
-
-    origin[0] = cos_theta*r.origin()[0] - sin_theta*r.origin()[2];
-    origin[2] = sin_theta*r.origin()[0] + cos_theta*r.origin()[2];
-
-    direction[0] = cos_theta*r.direction()[0] - sin_theta*r.direction()[2];
-    direction[2] = sin_theta*r.direction()[0] + cos_theta*r.direction()[2];
+    return ptr->occluded(rotate_ray(r), t_min, t_max);
+}
 
-    ray rotated_r(origin, direction, r.time());
+bool rotate_y::hit(const ray& r, double t_min, double t_max, hit_record& rec) const 
+{
+    ray rotated_r = rotate_ray(r);
 
     if (!ptr->hit(rotated_r, t_min, t_max, rec)) return false;
 
-    point3 p = rec.p;
-    vec3 normal = rec.normal;
+    rec.p = to_world(rec.p);
+    rec.set_face_normal(rotated_r, to_world(rec.normal));
 
-    p[0] =  cos_theta*rec.p[0] + sin_theta*rec.p[2];
-    p[2] = -sin_theta*rec.p[0] + cos_theta*rec.p[2];
+    return true;
+}
 
-    normal[0] =  cos_theta*rec.normal[0] + sin_theta*rec.normal[2];
-    normal[2] = -sin_theta*rec.normal[0] + cos_theta*rec.normal[2];
+double rotate_y::pdf_value(const point3& o, const vec3& v) const
+{
+    return ptr->pdf_value(to_object(o), to_object(v));
+}
 
-    rec.p = p;
-    rec.set_face_normal(rotated_r, normal);
+vec3 rotate_y::random(const point3& o) const
+{
+    return to_world(ptr->random(to_object(o)));
+}
 
-    return true;
+void rotate_y::collect_lights(std::vector<shared_ptr<hittable>>& lights) const
+{
+    std::vector<shared_ptr<hittable>> inner;
+    ptr->collect_lights(inner);
+    for (const auto& light : inner) lights.push_back(make_shared<rotate_y>(light, angle));
 }
 
 #endif
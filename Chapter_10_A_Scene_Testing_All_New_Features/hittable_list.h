@@ -20,7 +20,9 @@ class hittable_list : public hittable
         void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
         virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const override;
+        virtual void collect_lights(std::vector<shared_ptr<hittable>>& lights) const override;
 
     public:
         std::vector<shared_ptr<hittable>> objects;
@@ -43,6 +45,13 @@ bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& re
     return hit_anything;
 }
 
+bool hittable_list::occluded(const ray& r, double t_min, double t_max) const
+{
+    for (const auto& object : objects)
+        if (object->occluded(r, t_min, t_max)) return true;
+    return false;
+}
+
 bool hittable_list::bounding_box(double t0, double t1, aabb& output_box) const
 {
     if (objects.empty()) return false;
@@ -57,5 +66,10 @@ bool hittable_list::bounding_box(double t0, double t1, aabb& output_box) const
     }
     return true;
 }
+void hittable_list::collect_lights(std::vector<shared_ptr<hittable>>& lights) const
+{
+    collect_emitters(objects, lights);
+}
+
 #endif
 
@@ -0,0 +1,120 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "framebuffer.h"
+
+// Every writer assembles the whole file in memory and hands it to the stream in a single
+// write, so output costs one copy instead of a flush per pixel.
+enum class image_format { p3, p6, pfm };
+
+inline bool parse_image_format(const char* name, image_format& format)
+{
+    if      (!strcmp(name, "p3"))  format = image_format::p3;
+    else if (!strcmp(name, "p6"))  format = image_format::p6;
+    else if (!strcmp(name, "pfm")) format = image_format::pfm;
+    else return false;
+    return true;
+}
+
+inline std::string ppm_header(const char* magic, const framebuffer& image)
+{
+    return std::string(magic) + "\n" + std::to_string(image.width()) + ' '
+         + std::to_string(image.height()) + "\n255\n";
+}
+
+// ASCII PPM, one pixel per line, as the renderer has always written it.
+void write_ppm_p3(std::ostream& out, const framebuffer& image)
+{
+    auto pixels = image.to_rgb8();
+    std::string buffer = ppm_header("P3", image);
+    buffer.reserve(buffer.size() + 4*pixels.size());
+
+    for (size_t k = 0; k < pixels.size(); k++) {
+        buffer += std::to_string(pixels[k]);
+        buffer += (k % 3 == 2) ? '\n' : ' ';
+    }
+    out.write(buffer.data(), buffer.size());
+}
+
+// Binary PPM, three bytes per pixel.
+void write_ppm_p6(std::ostream& out, const framebuffer& image)
+{
+    auto pixels = image.to_rgb8();
+    std::string buffer = ppm_header("P6", image);
+    buffer.append(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+    out.write(buffer.data(), buffer.size());
+}
+
+// Portable float map with the linear (not gamma-corrected) pixel averages. PFM stores rows
+// bottom to top, which is the framebuffer's own order; the negative scale marks the data as
+// little-endian, so each float is written low byte first whatever the host's byte order.
+void write_pfm(std::ostream& out, const framebuffer& image)
+{
+    std::string buffer = "PF\n" + std::to_string(image.width()) + ' '
+                       + std::to_string(image.height()) + "\n-1.0\n";
+    auto header_size = buffer.size();
+    buffer.resize(header_size + 3*sizeof(float)*image.width()*image.height());
+
+    auto p = &buffer[header_size];
+    for (int j = 0; j < image.height(); ++j) {
+        for (int i = 0; i < image.width(); ++i) {
+            auto n = image.sample_count(i, j);
+            auto c = n > 0 ? image.sum(i, j) / n : color(0, 0, 0);
+            for (int k = 0; k < 3; k++) {
+                float value = float(c[k]);
+                uint32_t bits;
+                memcpy(&bits, &value, sizeof(bits));
+                for (int b = 0; b < 4; b++) *p++ = static_cast<char>((bits >> (8*b)) & 0xff);
+            }
+        }
+    }
+    out.write(buffer.data(), buffer.size());
+}
+
+void write_image(std::ostream& out, const framebuffer& image, image_format format)
+{
+    switch (format) {
+        case image_format::p3:  write_ppm_p3(out, image); break;
+        case image_format::p6:  write_ppm_p6(out, image); break;
+        case image_format::pfm: write_pfm(out, image);    break;
+    }
+    out.flush();
+}
+
+// filename with a four-digit frame number before its extension: out.ppm becomes out-0007.ppm.
+inline std::string numbered_filename(const std::string& filename, int number)
+{
+    char digits[16];
+    std::snprintf(digits, sizeof(digits), "-%04d", number);
+
+    auto slash = filename.find_last_of("/\\");
+    auto dot = filename.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return filename + digits;
+    return filename.substr(0, dot) + digits + filename.substr(dot);
+}
+
+// Writes to `filename`, or to standard output when it is empty.
+bool write_image(const std::string& filename, const framebuffer& image, image_format format)
+{
+    if (filename.empty()) {
+        write_image(std::cout, image, format);
+        return bool(std::cout);
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "ERROR: Could not open output file '" << filename << "'.\n";
+        return false;
+    }
+    write_image(file, image, format);
+    return bool(file);
+}
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "transform.h"
+
+// One placement of shared geometry. The geometry, usually a BVH (the bottom level), is
+// built once in its own object space and any number of instances refer to it, each only
+// adding a transform. Putting the instances themselves into a BVH gives the top level.
+// A ray is taken into object space to test the shared BVH, and the hit is brought back.
+// Affine transforms keep the ray parameter, so t needs no conversion.
+//
+// Lights inside an instance are sampled through an instance of their own: directions are
+// picked in object space, and densities are converted from object-space to world-space
+// solid angle, which a transform that scales or shears changes.
+class instance : public hittable
+{
+    public:
+        instance(shared_ptr<hittable> object, const transform& to_world)
+            : object(object), to_world(to_world) {}
+
+        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+        virtual bool bounding_box(double t0, double t1, aabb& output_box) const override;
+
+        virtual bool is_emitter() const override { return object->is_emitter(); }
+        virtual double pdf_value(const point3& o, const vec3& v) const override;
+        virtual vec3 random(const point3& o) const override;
+        virtual void collect_lights(std::vector<shared_ptr<hittable>>& lights) const override;
+
+    public:
+        shared_ptr<hittable> object;
+        transform to_world;
+};
+
+bool instance::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+    ray local(to_world.inverse_point(r.origin()), to_world.inverse_vector(r.direction()), r.time());
+    if (!object->hit(local, t_min, t_max, rec)) return false;
+
+    // The normal faces against the local ray, and still faces against the world ray after
+    // the inverse transpose, so front_face carries over as it is.
+    rec.p = to_world.point(rec.p);
+    rec.normal = unit_vector(to_world.normal(rec.normal));
+    return true;
+}
+
+bool instance::occluded(const ray& r, double t_min, double t_max) const
+{
+    ray local(to_world.inverse_point(r.origin()), to_world.inverse_vector(r.direction()), r.time());
+    return object->occluded(local, t_min, t_max);
+}
+
+bool instance::bounding_box(double t0, double t1, aabb& output_box) const
+{
+    if (!object->bounding_box(t0, t1, output_box)) return false;
+
+    output_box = to_world.box(output_box);
+    return true;
+}
+
+// A unit world direction w maps to the object-space direction A^-1 w, and a small cone
+// around it to one |det A^-1| / |A^-1 w|^3 times as wide, A being the linear part of
+// to_world. The density per world solid angle is the object-space one times that factor.
+double instance::pdf_value(const point3& o, const vec3& v) const
+{
+    auto local_v = to_world.inverse_vector(unit_vector(v));
+    auto pdf = object->pdf_value(to_world.inverse_point(o), local_v);
+    if (pdf <= 0) return 0;
+
+    auto length = local_v.length();
+    return pdf * fabs(to_world.inverse_determinant()) / (length*length*length);
+}
+
+vec3 instance::random(const point3& o) const
+{
+    return to_world.vector(object->random(to_world.inverse_point(o)));
+}
+
+void instance::collect_lights(std::vector<shared_ptr<hittable>>& lights) const
+{
+    std::vector<shared_ptr<hittable>> inner;
+    object->collect_lights(inner);
+    for (const auto& light : inner) lights.push_back(make_shared<instance>(light, to_world));
+}
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include <cstdint>
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "material.h"
+#include "lights.h"
+
+// Path counters, kept per tile by the renderer and summed at the end.
+struct path_statistics
+{
+    uint64_t paths = 0;
+    uint64_t bounces = 0;
+
+    void merge(const path_statistics& other)
+    {
+        paths += other.paths;
+        bounces += other.bounces;
+    }
+
+    double average_path_length() const { return paths ? double(bounces) / paths : 0.0; }
+};
+
+// Power heuristic weight (beta = 2) for a sample taken with density pdf_f while another
+// strategy could have produced it with density pdf_g.
+inline double power_heuristic(double pdf_f, double pdf_g)
+{
+    auto f2 = pdf_f * pdf_f;
+    auto g2 = pdf_g * pdf_g;
+    return f2 + g2 > 0 ? f2 / (f2 + g2) : 0.0;
+}
+
+// Traces a path as a loop rather than a recursion. Instead of adding up the radiance on
+// the way back out, it carries the product of attenuations (the throughput) forward and
+// adds emission as it goes. After rr_depth bounces, Russian roulette ends paths with a
+// probability that grows as their throughput fades, and reweights the survivors so the
+// estimate stays unbiased.
+//
+// When the scene has lights, every non-specular vertex also sends a shadow ray towards a
+// sampled light (next-event estimation). Emitters can then be reached by both strategies,
+// so both contributions are weighted with multiple importance sampling.
+class path_integrator
+{
+    public:
+        path_integrator(int max_depth, int rr_depth = 5, const light_registry* lights = nullptr)
+            : max_depth(max_depth), rr_depth(rr_depth), lights(lights) {}
+
+        color trace(ray r, const color& background, const hittable& world, path_statistics& stats) const;
+
+    private:
+        color sample_light(const ray& r_in, const hit_record& rec, const hittable& world) const;
+
+    public:
+        int max_depth;
+        int rr_depth;
+        const light_registry* lights;
+};
+
+color path_integrator::trace(ray r, const color& background, const hittable& world, 
+                             path_statistics& stats) const
+{
+    color radiance(0, 0, 0);
+    color throughput(1, 1, 1);
+    hit_record rec;
+
+    bool sample_lights = lights && !lights->empty();
+    bool specular_bounce = true;    // the camera ray counts as specular: no light sample led to it
+    double scatter_pdf = 0;
+    point3 scatter_origin;
+
+    stats.paths++;
+    for (int depth = 0; depth < max_depth; depth++) {
+        // Every bounce draws from its own block of random dimensions.
+        thread_sample_stream().next_bounce();
+        stats.bounces++;
+
+        // If the ray hits nothing, the background is all that is left to gather.
+        if (!world.hit(r, 0.001, infinity, rec)) {
+            radiance += throughput * background;
+            break;
+        }
+
+        ray scattered;
+        color attenuation;
+        if (rec.mat_ptr->is_emissive()) {
+            auto weight = 1.0;
+            if (sample_lights && !specular_bounce)
+                weight = power_heuristic(scatter_pdf, lights->pdf_value(scatter_origin, r.direction()));
+            radiance += weight * throughput * rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+        }
+
+        specular_bounce = rec.mat_ptr->is_specular();
+        if (sample_lights && !specular_bounce) radiance += throughput * sample_light(r, rec, world);
+
+        if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered)) break;
+
+        if (!specular_bounce) {
+            scatter_pdf = rec.mat_ptr->scatter_pdf(r, rec, scattered.direction());
+            scatter_origin = rec.p;
+        }
+
+        throughput = throughput * attenuation;
+        r = scattered;
+
+        if (depth + 1 >= rr_depth) {
+            auto survive = fmin(fmax(throughput.x(), fmax(throughput.y(), throughput.z())), 0.95);
+            if (random_double() >= survive) break;
+            throughput /= survive;
+        }
+    }
+
+    return radiance;
+}
+
+// One light sample from a non-specular vertex: the emission seen along a direction picked
+// by the light registry, times the BSDF, divided by the direction's density and weighted
+// against the chance that scatter() would have found the same direction.
+color path_integrator::sample_light(const ray& r_in, const hit_record& rec, const hittable& world) const
+{
+    auto direction = lights->random(rec.p);
+    auto light_pdf = lights->pdf_value(rec.p, direction);
+    if (light_pdf <= 0) return color(0,0,0);
+
+    auto f = rec.mat_ptr->eval(r_in, rec, direction);
+    if (f.length_squared() <= 0) return color(0,0,0);
+
+    // Find where the direction meets a light, then only ask whether anything lies in
+    // between. The segment stops just short of the light so that it doesn't block itself.
+    hit_record light_rec;
+    ray shadow_ray(rec.p, direction, r_in.time());
+    if (!lights->hit(shadow_ray, 0.001, infinity, light_rec)) return color(0,0,0);
+    if (world.occluded(shadow_ray, 0.001, light_rec.t * (1 - 1e-9))) return color(0,0,0);
+
+    auto weight = power_heuristic(light_pdf, rec.mat_ptr->scatter_pdf(r_in, rec, direction));
+    return weight * f * light_rec.mat_ptr->emitted(light_rec.u, light_rec.v, light_rec.p) / light_pdf;
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <vector>
+
+#include "hittable.h"
+
+// The emitters of a scene, gathered once after the scene is built. Sampling picks one of
+// them uniformly, so the density of a direction is the average of their densities.
+class light_registry
+{
+    public:
+        light_registry() {}
+        light_registry(const hittable& world) { world.collect_lights(lights); }
+
+        void add(shared_ptr<hittable> light) { lights.push_back(light); }
+
+        bool empty() const { return lights.empty(); }
+        size_t size() const { return lights.size(); }
+
+        vec3 random(const point3& o) const
+        {
+            auto n = lights.size();
+            auto i = std::min(static_cast<size_t>(random_double() * n), n - 1);
+            return lights[i]->random(o);
+        }
+
+        double pdf_value(const point3& o, const vec3& v) const
+        {
+            auto sum = 0.0;
+            for (const auto& light : lights) sum += light->pdf_value(o, v);
+            return sum / lights.size();
+        }
+
+        // Closest hit along r among the lights alone, ignoring everything else in the scene.
+        bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+        {
+            bool hit_anything = false;
+            for (const auto& light : lights) {
+                if (light->hit(r, t_min, t_max, rec)) {
+                    hit_anything = true;
+                    t_max = rec.t;
+                }
+            }
+            return hit_anything;
+        }
+
+    public:
+        std::vector<shared_ptr<hittable>> lights;
+};
+
+#endif
@@ -0,0 +1,445 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "bvh.h"
+#include "traversal_stack.h"
+
+// One node of a flattened BVH, 32 bytes so that two share a cache line. Bounds are stored
+// in single precision, rounded outwards so that they still contain the double precision box.
+struct linear_bvh_node
+{
+    float bounds[2][3]; // min and max corner, indexed by the ray's sign bits
+    uint32_t offset;    // interior: index of the second child, leaf: first primitive
+    uint16_t count;     // primitives in a leaf, 0 for an interior node
+    uint8_t axis;       // split axis of an interior node
+    uint8_t pad;
+
+    bool is_leaf() const { return count > 0; }
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should fill half a cache line");
+
+// The node array of a linear_bvh. The builders fill a vector that the array owns; a tree
+// loaded from the BVH cache instead points straight into the mapped file, which the array
+// keeps alive through `storage`. Reading is the same either way. modify() hands out the
+// vector for writing, copying mapped nodes into it first.
+class linear_bvh_node_array
+{
+    public:
+        linear_bvh_node_array() {}
+        linear_bvh_node_array(std::vector<linear_bvh_node> nodes) { *this = std::move(nodes); }
+
+        linear_bvh_node_array(const linear_bvh_node_array& other) { *this = other; }
+        linear_bvh_node_array(linear_bvh_node_array&& other) { *this = std::move(other); }
+
+        linear_bvh_node_array& operator=(const linear_bvh_node_array& other)
+        {
+            if (this == &other) return *this;
+            owned = other.owned;
+            storage = other.storage;
+            nodes = storage ? other.nodes : owned.data();
+            count = other.count;
+            return *this;
+        }
+
+        linear_bvh_node_array& operator=(linear_bvh_node_array&& other)
+        {
+            if (this == &other) return *this;
+            owned = std::move(other.owned);
+            storage = std::move(other.storage);
+            nodes = storage ? other.nodes : owned.data();
+            count = other.count;
+            other.owned.clear();
+            other.nodes = nullptr;
+            other.count = 0;
+            return *this;
+        }
+
+        linear_bvh_node_array& operator=(std::vector<linear_bvh_node> v)
+        {
+            owned = std::move(v);
+            storage.reset();
+            nodes = owned.data();
+            count = owned.size();
+            return *this;
+        }
+
+        // Views count nodes at `mapped`, which stay valid while storage is held.
+        void map(std::shared_ptr<const void> mapping, const linear_bvh_node* mapped, size_t n)
+        {
+            owned.clear();
+            storage = std::move(mapping);
+            nodes = mapped;
+            count = n;
+        }
+
+        std::vector<linear_bvh_node>& modify()
+        {
+            if (storage) {
+                owned.assign(nodes, nodes + count);
+                storage.reset();
+                nodes = owned.data();
+            }
+            return owned;
+        }
+
+        bool is_mapped() const { return storage != nullptr; }
+
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        const linear_bvh_node* data() const { return nodes; }
+        const linear_bvh_node& operator[](size_t i) const { return nodes[i]; }
+
+    private:
+        std::vector<linear_bvh_node> owned;
+        std::shared_ptr<const void> storage;
+        const linear_bvh_node* nodes = nullptr;
+        size_t count = 0;
+};
+
+// A BVH stored depth-first in one array: the first child of an interior node directly
+// follows it, the second is found through its offset. Leaves point into a primitive array
+// ordered the same way, and traversal walks the tree with a small explicit stack instead
+// of virtual calls on every node.
+//
+// Traversal is front to back: at each interior node the child on the near side of the
+// split axis (by the sign of the ray direction) is visited first, and the far child is
+// pushed along with the distance at which the ray enters its box. A pushed subtree is
+// dropped when that distance already lies beyond the closest hit found so far.
+class linear_bvh : public hittable
+{
+    public:
+        linear_bvh() {}
+        linear_bvh(hittable_list& list, double time0, double time1,
+                   const bvh_build_options& options = bvh_build_options());
+
+        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+
+        virtual bool bounding_box(double /*t0*/, double /*t1*/, aabb& output_box) const override
+        {
+            output_box = box;
+            return !nodes.empty();
+        }
+
+        virtual void collect_lights(std::vector<shared_ptr<hittable>>& lights) const override;
+
+        // Expected cost of tracing a ray that hits the root box, under the SAH cost model.
+        double sah_cost(const bvh_build_options& options = bvh_build_options()) const;
+
+        size_t node_count() const { return nodes.size(); }
+
+        double node_area(const linear_bvh_node& node) const;
+
+        // Recomputes every node's bounds bottom-up from the primitives' current boxes,
+        // keeping the tree as it is.
+        void refit(double time0, double time1);
+
+        // Builds a new tree over the same primitives.
+        void rebuild(double time0, double time1, const bvh_build_options& options = bvh_build_options());
+
+        // Stores box in a node, rounded outwards to single precision.
+        static void set_bounds(linear_bvh_node& node, const aabb& box);
+
+    private:
+        // Appends the subtree over prims[start,end), rooted at the given depth, to nodes and
+        // primitives, and returns the index of its root and its box. Large ranges build their
+        // second half into separate arrays on another thread, which are then appended and
+        // relocated.
+        static uint32_t build(std::vector<bvh_primitive>& prims, size_t start, size_t end,
+                              const bvh_build_options& options, int tasks, int depth,
+                              std::vector<linear_bvh_node>& nodes, std::vector<shared_ptr<hittable>>& primitives,
+                              aabb& node_box);
+        double sah_cost(uint32_t index, const bvh_build_options& options) const;
+
+    public:
+        linear_bvh_node_array nodes;
+        std::vector<shared_ptr<hittable>> primitives;
+        aabb box;
+        double built_cost = 0;  // SAH cost right after the last build
+};
+
+linear_bvh::linear_bvh(hittable_list& list, double time0, double time1, const bvh_build_options& options)
+{
+    if (list.objects.empty()) return;
+
+    auto prims = make_bvh_primitives(list.objects, 0, list.objects.size(), time0, time1);
+    bvh_prepare_primitives(prims, options);
+    std::vector<linear_bvh_node> built;
+    built.reserve(2*prims.size());
+    primitives.reserve(prims.size());
+    build(prims, 0, prims.size(), options, bvh_build_tasks(options), 0, built, primitives, box);
+    nodes = std::move(built);
+    built_cost = sah_cost(options);
+}
+
+uint32_t linear_bvh::build(std::vector<bvh_primitive>& prims, size_t start, size_t end,
+                           const bvh_build_options& options, int tasks, int depth,
+                           std::vector<linear_bvh_node>& nodes, std::vector<shared_ptr<hittable>>& primitives,
+                           aabb& node_box)
+{
+    auto index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    linear_bvh_node node;
+    node.axis = 0;
+    node.pad = 0;
+
+    int axis = 0;
+    size_t mid = end;
+    double split_cost = (end - start > 1) ? bvh_split(prims, start, end, depth, options, axis, mid) : 0.0;
+
+    // Boxes are gathered bottom-up, so each primitive's box is looked at once.
+    node_box = aabb::empty();
+    if (bvh_make_leaf(end - start, split_cost, options)) {
+        node.offset = static_cast<uint32_t>(primitives.size());
+        node.count = static_cast<uint16_t>(end - start);
+        for (size_t i = start; i < end; i++) {
+            primitives.push_back(prims[i].object);
+            node_box = surrounding_box(node_box, prims[i].box);
+        }
+    }
+    else {
+        node.count = 0;
+        node.axis = static_cast<uint8_t>(axis);
+
+        aabb left_box, right_box;
+        if (tasks > 1 && end - start >= bvh_parallel_min_span) {
+            std::vector<linear_bvh_node> right_nodes;
+            std::vector<shared_ptr<hittable>> right_primitives;
+            auto right_task = std::async(std::launch::async, [&] {
+                build(prims, mid, end, options, tasks / 2, depth + 1, right_nodes, right_primitives, right_box);
+            });
+            build(prims, start, mid, options, tasks - tasks / 2, depth + 1, nodes, primitives, left_box);
+            right_task.get();
+
+            // The second subtree was numbered from zero; shift it to where it lands.
+            auto node_base = static_cast<uint32_t>(nodes.size());
+            auto prim_base = static_cast<uint32_t>(primitives.size());
+            for (auto right_node : right_nodes) {
+                right_node.offset += right_node.is_leaf() ? prim_base : node_base;
+                nodes.push_back(right_node);
+            }
+            primitives.insert(primitives.end(), right_primitives.begin(), right_primitives.end());
+            node.offset = node_base;
+        }
+        else {
+            build(prims, start, mid, options, 1, depth + 1, nodes, primitives, left_box);
+            node.offset = build(prims, mid, end, options, 1, depth + 1, nodes, primitives, right_box);
+        }
+        node_box = surrounding_box(left_box, right_box);
+    }
+
+    set_bounds(node, node_box);
+    nodes[index] = node;
+    return index;
+}
+
+void linear_bvh::set_bounds(linear_bvh_node& node, const aabb& box)
+{
+    for (int a = 0; a < 3; a++) {
+        node.bounds[0][a] = std::nextafter(static_cast<float>(box.min()[a]), -INFINITY);
+        node.bounds[1][a] = std::nextafter(static_cast<float>(box.max()[a]),  INFINITY);
+    }
+}
+
+void linear_bvh::refit(double time0, double time1)
+{
+    // Children are stored after their parent, so a backwards sweep sees them first.
+    auto& writable = nodes.modify();
+    std::vector<aabb> boxes(writable.size());
+    for (size_t i = writable.size(); i-- > 0; ) {
+        auto& node = writable[i];
+        auto node_box = aabb::empty();
+        if (node.is_leaf()) {
+            for (uint32_t k = 0; k < node.count; k++) {
+                aabb prim_box;
+                if (primitives[node.offset + k]->bounding_box(time0, time1, prim_box))
+                    node_box = surrounding_box(node_box, prim_box);
+            }
+        }
+        else {
+            node_box = surrounding_box(boxes[i + 1], boxes[node.offset]);
+        }
+        boxes[i] = node_box;
+        set_bounds(node, node_box);
+    }
+    if (!nodes.empty()) box = boxes[0];
+}
+
+void linear_bvh::rebuild(double time0, double time1, const bvh_build_options& options)
+{
+    hittable_list list;
+    list.objects = primitives;
+    *this = linear_bvh(list, time0, time1, options);
+}
+
+// Box test of a flattened node: the same branchless slab test as aabb::hit(), also
+// reporting where the ray enters the box. The traversals below take this as a policy, so
+// that layouts which find a node's box differently (motion_bvh) share them.
+struct linear_node_box
+{
+    bool hit(const linear_bvh_node& node, const ray& r, double t_min, double t_max, double& t_entry) const
+    {
+        for (int a = 0; a < 3; a++) {
+            auto t0 = (node.bounds[r.sign[a]][a]   - r.orig[a]) * r.inv_dir[a];
+            auto t1 = (node.bounds[1-r.sign[a]][a] - r.orig[a]) * r.inv_dir[a];
+            t1 *= 1 + 2*aabb::slab_gamma;
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+        }
+        t_entry = t_min;
+        return t_min <= t_max;
+    }
+};
+
+// Closest hit in a non-empty flattened tree, front to back as described at linear_bvh.
+template <typename node_type, typename node_box>
+bool linear_bvh_closest_hit(const node_type* nodes, const std::vector<shared_ptr<hittable>>& primitives,
+                            const node_box& boxes, const ray& r, double t_min, double t_max, hit_record& rec)
+{
+    struct entry { uint32_t node; double t; };
+    traversal_stack<entry> stack;
+    bool hit_anything = false;
+
+    RT_BVH_COUNT(traversals, 1);
+    RT_BVH_COUNT(box_tests, 1);
+    double t_entry;
+    if (!boxes.hit(nodes[0], r, t_min, t_max, t_entry)) return false;
+    uint32_t current = 0;
+
+    // Every node reaching the top of the loop has passed its box test.
+    while (true) {
+        const auto& node = nodes[current];
+        RT_BVH_COUNT(nodes_visited, 1);
+        if (node.is_leaf()) {
+            RT_BVH_COUNT(primitive_tests, node.count);
+            for (uint32_t i = 0; i < node.count; i++) {
+                if (primitives[node.offset + i]->hit(r, t_min, t_max, rec)) {
+                    hit_anything = true;
+                    t_max = rec.t;
+                }
+            }
+        }
+        else {
+            auto near = r.sign[node.axis] ? node.offset : current + 1;
+            auto far  = r.sign[node.axis] ? current + 1 : node.offset;
+
+            double t_near, t_far;
+            RT_BVH_COUNT(box_tests, 2);
+            bool hit_near = boxes.hit(nodes[near], r, t_min, t_max, t_near);
+            bool hit_far  = boxes.hit(nodes[far],  r, t_min, t_max, t_far);
+
+            if (hit_near) {
+                if (hit_far) stack.push({ far, t_far });
+                current = near;
+                continue;
+            }
+            if (hit_far) {
+                current = far;
+                continue;
+            }
+        }
+
+        // Resume with the most recently deferred subtree, dropping those the ray only enters
+        // beyond the closest hit.
+        while (!stack.empty() && stack.top().t >= t_max) stack.pop();
+        if (stack.empty()) break;
+        current = stack.pop().node;
+    }
+
+    return hit_anything;
+}
+
+// Whether anything in a non-empty flattened tree blocks the ray. Depth-first, stopping at
+// the first primitive that does.
+template <typename node_type, typename node_box>
+bool linear_bvh_any_hit(const node_type* nodes, const std::vector<shared_ptr<hittable>>& primitives,
+                        const node_box& boxes, const ray& r, double t_min, double t_max)
+{
+    traversal_stack<uint32_t> stack;
+    double t_entry;
+
+    RT_BVH_COUNT(traversals, 1);
+    RT_BVH_COUNT(box_tests, 1);
+    if (!boxes.hit(nodes[0], r, t_min, t_max, t_entry)) return false;
+    uint32_t current = 0;
+
+    while (true) {
+        const auto& node = nodes[current];
+        RT_BVH_COUNT(nodes_visited, 1);
+        if (node.is_leaf()) {
+            for (uint32_t i = 0; i < node.count; i++) {
+                RT_BVH_COUNT(primitive_tests, 1);
+                if (primitives[node.offset + i]->occluded(r, t_min, t_max)) return true;
+            }
+        }
+        else {
+            RT_BVH_COUNT(box_tests, 2);
+            bool hit_first  = boxes.hit(nodes[current + 1], r, t_min, t_max, t_entry);
+            bool hit_second = boxes.hit(nodes[node.offset], r, t_min, t_max, t_entry);
+
+            if (hit_first) {
+                if (hit_second) stack.push(node.offset);
+                current = current + 1;
+                continue;
+            }
+            if (hit_second) {
+                current = node.offset;
+                continue;
+            }
+        }
+
+        if (stack.empty()) return false;
+        current = stack.pop();
+    }
+}
+
+bool linear_bvh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+    if (nodes.empty()) return false;
+    return linear_bvh_closest_hit(nodes.data(), primitives, linear_node_box(), r, t_min, t_max, rec);
+}
+
+bool linear_bvh::occluded(const ray& r, double t_min, double t_max) const
+{
+    if (nodes.empty()) return false;
+    return linear_bvh_any_hit(nodes.data(), primitives, linear_node_box(), r, t_min, t_max);
+}
+
+void linear_bvh::collect_lights(std::vector<shared_ptr<hittable>>& lights) const
+{
+    collect_emitters(primitives, lights);
+}
+
+double linear_bvh::node_area(const linear_bvh_node& node) const
+{
+    auto dx = node.bounds[1][0] - node.bounds[0][0];
+    auto dy = node.bounds[1][1] - node.bounds[0][1];
+    auto dz = node.bounds[1][2] - node.bounds[0][2];
+    return 2 * (double(dx)*dy + double(dy)*dz + double(dz)*dx);
+}
+
+double linear_bvh::sah_cost(const bvh_build_options& options) const
+{
+    return nodes.empty() ? 0.0 : sah_cost(0, options);
+}
+
+double linear_bvh::sah_cost(uint32_t index, const bvh_build_options& options) const
+{
+    const auto& node = nodes[index];
+    if (node.is_leaf()) return options.traversal_cost + options.intersection_cost * node.count;
+
+    auto area = node_area(node);
+    return options.traversal_cost
+         + bvh_area_ratio(node_area(nodes[index + 1]), area) * sah_cost(index + 1, options)
+         + bvh_area_ratio(node_area(nodes[node.offset]), area) * sah_cost(node.offset, options);
+}
+
+#endif
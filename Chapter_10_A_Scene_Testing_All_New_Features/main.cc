@@ -1,5 +1,7 @@
 #include "rtweekend.h"
 #include "color.h"
+#include "framebuffer.h"
+#include "image_writer.h"
 #include "hittable_list.h"
 #include "sphere.h"
 #include "moving_sphere.h"
@@ -7,31 +9,41 @@
 #include "material.h"
 #include "aarect.h"
 #include "box.h"
-#include "bvh.h"
+#include "accel.h"
+#include "bvh_stats.h"
+#include "bvh_check.h"
 #include "constant_medium.h"
-
+#include "instance.h"
+#include "integrator.h"
+#include "scheduler.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <omp.h>
+#include <mutex>
+
+// Layout and build options of the BVHs that scenes build, set from the command line
+bvh_layout scene_bvh_layout = bvh_layout::linear;
+bvh_build_options scene_bvh_options;
+std::string scene_bvh_cache;    // directory of cached BVHs, empty always builds
+bool scene_bvh_stats = false;   // print the shape of every BVH after building it
 
-color ray_color(const ray& r, const color& background, const hittable& world, int recursion_depth)
+// Builds a BVH over list with the scene settings, or loads it from the BVH cache, and
+// reports how long that took and the tree's SAH cost.
+shared_ptr<hittable> build_scene_bvh(const char* name, hittable_list& list, double time0, double time1)
 {
-    hit_record rec;
-    
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (recursion_depth <= 0) return color(0, 0, 0);
-    
-    // If the ray hits nothing, return the background color.
-    if (!world.hit(r, 0.001, infinity, rec))
-        return background;
-
-    ray scattered;
-    color attenuation;
-    color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
-
-    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-        return emitted;
-
-    return emitted + attenuation * ray_color(scattered, background, world, recursion_depth-1);
+    auto start = std::chrono::steady_clock::now();
+    auto bvh = scene_bvh_cache.empty()
+             ? make_bvh(list, time0, time1, scene_bvh_layout, scene_bvh_options)
+             : make_cached_bvh(list, time0, time1, scene_bvh_layout, scene_bvh_options, scene_bvh_cache);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cerr << name << " BVH: " << list.objects.size() << " objects, built in " << elapsed.count()
+              << " ms, SAH cost " << bvh_sah_cost(*bvh, scene_bvh_options) << '\n';
+    if (scene_bvh_stats) bvh_statistics(*bvh, scene_bvh_options).print(std::cerr, name);
+    return bvh;
 }
 
 hittable_list random_scene() 
@@ -208,7 +220,8 @@ hittable_list final_scene()
 
     hittable_list objects;
 
-    objects.add(make_shared<bvh_node>(boxes1, 0, 1));
+    auto boxes1_bvh = build_scene_bvh("Ground boxes", boxes1, 0, 1);
+    objects.add(boxes1_bvh);
 
     auto light = make_shared<diffuse_light>(color(7, 7, 7));
     objects.add(make_shared<xz_rect>(123, 423, 147, 412, 554, light));
@@ -237,11 +250,12 @@ hittable_list final_scene()
     int ns = 1000;
     for (int j = 0; j < ns; j++) boxes2.add(make_shared<sphere>(point3::random(0,165), 10, white));
 
+    auto boxes2_bvh = build_scene_bvh("Sphere cluster", boxes2, 0.0, 1.0);
     objects.add
     (
         make_shared<translate>
         (
-            make_shared<rotate_y>(make_shared<bvh_node>(boxes2, 0.0, 1.0), 15), 
+            make_shared<rotate_y>(boxes2_bvh, 15), 
             vec3(-100,270,395)
         )
     );
@@ -249,8 +263,115 @@ hittable_list final_scene()
     return objects;
 }
 
-int main() 
+// A field of 10,000 sphere clusters. Every cluster is an instance of the same 1000-sphere
+// BVH, turned and scaled differently, so the scene stores 1000 spheres rather than 10 million.
+hittable_list instanced_clusters()
 {
+    hittable_list cluster;
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    for (int j = 0; j < 1000; j++) cluster.add(make_shared<sphere>(point3::random(0,165), 10, white));
+    auto cluster_bvh = build_scene_bvh("Sphere cluster", cluster, 0.0, 1.0);
+
+    hittable_list objects;
+    auto checker = make_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
+    objects.add(make_shared<sphere>(point3(0,-100000,0), 100000, make_shared<lambertian>(checker)));
+
+    auto to_center = transform::translation(vec3(-82.5, 0, -82.5));
+    for (int i = 0; i < 100; i++) {
+        for (int k = 0; k < 100; k++) {
+            auto to_world = transform::translation(vec3(250*i, 0, 250*k))
+                          * transform::rotation_y(random_double(0, 360))
+                          * transform::scaling(random_double(0.5, 1.2))
+                          * to_center;
+            objects.add(make_shared<instance>(cluster_bvh, to_world));
+        }
+    }
+
+    return objects;
+}
+
+int main(int argc, char* argv[])
+{
+    // Options
+    int num_threads = 0;    // 0 means one thread per hardware core
+    int scene = 0;          // 0 picks the default scene
+    int spp_override = 0;   // 0 keeps the scene's samples per pixel
+    int width_override = 0; // 0 keeps the scene's image width
+    uint64_t seed = 0;
+    image_format format = image_format::p3;
+    std::string output;     // empty writes the image to standard output
+    int pass_spp = 0;       // samples per pixel per progressive pass, 0 renders in one pass
+    std::string checkpoint; // file the accumulation buffer is saved to between passes
+    double checkpoint_interval = 0;  // minimum seconds between checkpoints
+    bool resume = false;
+    double adaptive_threshold = 0;   // relative error at which a pixel stops, 0 disables
+    int min_spp = 16;       // samples every pixel takes before it may stop early
+    std::string sampler_name = "independent";
+    int depth_override = 0; // 0 keeps the scene's maximum path depth
+    int rr_depth = 5;       // bounces before Russian roulette starts
+    bool light_sampling = true;
+    bool accelerate = true; // build a BVH over the scene's top-level objects
+    int frames = 1;         // frames of animation, each written to its own numbered file
+    int bvh_check_rays = 0; // rays to compare every BVH layout's hit() and occluded() on
+
+    for (int a = 1; a < argc; a++) {
+        if      (!strcmp(argv[a], "--threads") && a+1 < argc) num_threads = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--scene")   && a+1 < argc) scene = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--spp")     && a+1 < argc) spp_override = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--width")   && a+1 < argc) width_override = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--seed")    && a+1 < argc) seed = strtoull(argv[++a], nullptr, 10);
+        else if (!strcmp(argv[a], "--output")  && a+1 < argc) output = argv[++a];
+        else if (!strcmp(argv[a], "--format")  && a+1 < argc && parse_image_format(argv[a+1], format)) ++a;
+        else if (!strcmp(argv[a], "--pass-spp")   && a+1 < argc) pass_spp = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--checkpoint") && a+1 < argc) checkpoint = argv[++a];
+        else if (!strcmp(argv[a], "--checkpoint-interval") && a+1 < argc) checkpoint_interval = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--resume")) resume = true;
+        else if (!strcmp(argv[a], "--adaptive") && a+1 < argc) adaptive_threshold = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--min-spp")  && a+1 < argc && atoi(argv[a+1]) >= 1) min_spp = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--sampler")  && a+1 < argc) sampler_name = argv[++a];
+        else if (!strcmp(argv[a], "--max-depth") && a+1 < argc) depth_override = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--rr-depth")  && a+1 < argc) rr_depth = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--no-light-sampling")) light_sampling = false;
+        else if (!strcmp(argv[a], "--no-accel")) accelerate = false;
+        else if (!strcmp(argv[a], "--frames")   && a+1 < argc) frames = std::max(1, atoi(argv[++a]));
+        else if (!strcmp(argv[a], "--bvh-cache") && a+1 < argc) scene_bvh_cache = argv[++a];
+        else if (!strcmp(argv[a], "--bvh-stats")) scene_bvh_stats = true;
+        else if (!strcmp(argv[a], "--bvh-check") && a+1 < argc) bvh_check_rays = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--bvh") && a+1 < argc && parse_bvh_layout(argv[a+1], scene_bvh_layout)) ++a;
+        else if (!strcmp(argv[a], "--leaf-size") && a+1 < argc) scene_bvh_options.max_leaf_size = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--build-threads") && a+1 < argc) scene_bvh_options.build_threads = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--builder") && a+1 < argc && parse_bvh_builder(argv[a+1], scene_bvh_options.builder)) ++a;
+        else if (!strcmp(argv[a], "--morton-bits") && a+1 < argc && parse_morton_bits(argv[a+1], scene_bvh_options.morton_bits)) ++a;
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--threads N] [--scene N] [--spp N] [--width N] [--seed N]"
+                      << " [--format p3|p6|pfm] [--output FILE]"
+                      << " [--pass-spp N] [--checkpoint FILE] [--checkpoint-interval SECONDS] [--resume]"
+                      << " [--adaptive THRESHOLD] [--min-spp N]"
+                      << " [--sampler independent|stratified|halton|sobol]"
+                      << " [--max-depth N] [--rr-depth N] [--no-light-sampling] [--no-accel] [--frames N]"
+                      << " [--bvh-cache DIR] [--bvh-stats] [--bvh-check RAYS]"
+                      << " [--bvh binary|linear|bvh4|bvh8|motion] [--leaf-size 1-8] [--build-threads N]"
+                      << " [--builder sah|lbvh] [--morton-bits 30|63]\n";
+            return 1;
+        }
+    }
+
+    if (resume && checkpoint.empty()) {
+        std::cerr << "ERROR: --resume needs a --checkpoint file to resume from.\n";
+        return 1;
+    }
+    if (frames > 1 && (output.empty() || !checkpoint.empty())) {
+        std::cerr << "ERROR: --frames needs an --output file to number and can't be checkpointed.\n";
+        return 1;
+    }
+
+    shared_ptr<sampler> pixel_sampler;
+    if (!make_sampler(sampler_name, 1, pixel_sampler)) {
+        std::cerr << "ERROR: Unknown sampler '" << sampler_name << "'.\n";
+        return 1;
+    }
+
+    seed_random(seed);
 
     // Image
     auto aspect_ratio = 16.0 / 9.0;
@@ -267,7 +388,7 @@ int main()
     auto aperture = 0.0;
     color background(0,0,0);
 
-    switch (0) 
+    switch (scene) 
     {
         case 1:
             world = random_scene();
@@ -326,6 +447,15 @@ int main()
             lookat = point3(278, 278, 0);
             vfov = 40.0;
             break;
+        case 9:
+            world = instanced_clusters();
+            image_width = 400;
+            samples_per_pixel = 100;
+            background = color(0.70, 0.80, 1.00);
+            lookfrom = point3(-1500, 2500, -1500);
+            lookat = point3(8000, 0, 8000);
+            vfov = 40.0;
+            break;
         // 10. A Scene Testing All New Features
         default:
         case 8:
@@ -340,40 +470,158 @@ int main()
             break;
     }
 
+    if (spp_override > 0) samples_per_pixel = spp_override;
+    if (width_override > 0) image_width = width_override;
+    if (depth_override > 0) max_recursion_depth = depth_override;
+    make_sampler(sampler_name, samples_per_pixel, pixel_sampler);
+
     // Camera
     vec3 vup(0,1,0);
     auto dist_to_focus = 10.0;
     int image_height = static_cast<int>(image_width / aspect_ratio);
 
-    camera cam(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus, 0.0, 1.0);
+    // Scenes list their objects flat. Put everything with bounds under one BVH so that rays
+    // don't test each top-level object in turn; anything unbounded stays beside it.
+    shared_ptr<hittable> world_bvh;
+    if (accelerate && world.objects.size() > 1) {
+        hittable_list bounded, top;
+        for (const auto& object : world.objects) {
+            aabb object_box;
+            if (object->bounding_box(0.0, 1.0, object_box)) bounded.add(object);
+            else top.add(object);
+        }
+        world_bvh = build_scene_bvh("World", bounded, 0.0, 1.0);
+        // The check draws its rays from this thread's random stream; put the stream back
+        // afterwards so that checking doesn't change the image. Media pick their hits at
+        // random, so no two traversals need agree on them, and they are left out.
+        if (bvh_check_rays > 0) {
+            hittable_list checked;
+            for (const auto& object : bounded.objects)
+                if (!dynamic_cast<const constant_medium*>(object.get())) checked.add(object);
+
+            auto saved = thread_random_engine();
+            if (bvh_check_layouts(checked, 0.0, 1.0, bvh_check_rays, scene_bvh_options, std::cerr)) return 1;
+            thread_random_engine() = saved;
+        }
+        top.add(world_bvh);
+        world = top;
+    }
+
+    light_registry lights;
+    if (light_sampling) lights = light_registry(world);
+    std::cerr << "Sampling " << lights.size() << " lights\n";
+
+    if (pass_spp <= 0) pass_spp = adaptive_threshold > 0 ? min_spp : samples_per_pixel;
 
     // Render
-    // std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-    // The rows are written out from top to bottom
-    std::vector<std::vector<std::vector<int>>> pixels;
-    pixels.resize(image_height);
-    omp_set_num_threads(4);
-    for (int j = image_height - 1; j >= 0; --j) {
-        // The pixels are written out in rows with pixels left to right
-        pixels[j].resize(image_width);
-        std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-#pragma omp parallel for
-        for (int i = 0; i < image_width; ++i) {
-            color pixel_color(0, 0, 0);
-            for (int cnt = 0; cnt < samples_per_pixel; cnt++) {
-                auto u = (i + random_double()) / (image_width-1);
-                auto v = (j + random_double()) / (image_height-1);
-                ray r = cam.get_ray(u, v);
-                pixel_color += ray_color(r, background, world, max_recursion_depth);
+    // The image is rendered in progressive passes of pass_spp samples per pixel. Each pass is
+    // split into tiles that a pool of workers renders, stealing from each other once their
+    // own tiles run out. Sample indices continue from each pixel's count, so a resumed render
+    // produces the same samples an uninterrupted one would have.
+    // With adaptive sampling, a pixel that has at least min_spp samples (and --spp is the
+    // maximum) stops once its relative error drops below the threshold.
+    //
+    // An animation renders frame f over the shutter interval [f, f+1]. Moving objects carry
+    // on moving, so between frames the world BVH is refitted to their new bounds, and
+    // rebuilt once refitting has let it degrade too far.
+    // The workers are started once and render every pass of every frame.
+    tile_scheduler scheduler(image_width, image_height, 16, num_threads);
+    for (int frame = 0; frame < frames; frame++) {
+        double time0 = frame, time1 = frame + 1;
+        if (frame > 0 && world_bvh) {
+            auto start = std::chrono::steady_clock::now();
+            bool rebuilt = bvh_update(*world_bvh, time0, time1, scene_bvh_options);
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            std::cerr << "\nFrame " << frame << ": World BVH " << (rebuilt ? "rebuilt" : "refitted") << " in "
+                      << elapsed.count() << " ms, SAH cost " << bvh_sah_cost(*world_bvh, scene_bvh_options) << '\n';
+        }
+
+        camera cam(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus, time0, time1);
+        framebuffer image(image_width, image_height);
+
+        auto pixel_done = [&](int i, int j, int pass_end) {
+            int n = image.sample_count(i, j);
+            return n >= pass_end || (adaptive_threshold > 0 && n >= min_spp
+                                     && image.relative_error(i, j) < adaptive_threshold);
+        };
+
+        // Checkpoints only resume renders of the same scene, seed, path settings and sampler.
+        uint64_t render_tag = hash64(hash64(hash64(hash64(seed) + scene) + max_recursion_depth) + rr_depth)
+                            + light_sampling;
+        for (char c : sampler_name) render_tag = hash64(render_tag + c);
+        // A checkpoint that can't be resumed is left alone rather than overwritten by a fresh render.
+        if (resume) {
+            if (!image.load(checkpoint, render_tag)) return 1;
+            std::cerr << "Resumed from '" << checkpoint << "' at " << image.min_sample_count() << " spp\n";
+        }
+
+        path_integrator integrator(max_recursion_depth, rr_depth, &lights);
+        path_statistics render_stats;
+        bvh_counters render_bvh_counters;
+        std::mutex stats_mutex;
+
+        auto last_checkpoint = std::chrono::steady_clock::now();
+
+        int first_pass = image.min_sample_count() / pass_spp;
+        for (int pass_start = first_pass*pass_spp; pass_start < samples_per_pixel; pass_start += pass_spp) {
+            int pass_end = std::min(pass_start + pass_spp, samples_per_pixel);
+
+            std::atomic<bool> pass_rendered(false);
+            std::cerr << "\nPass " << pass_start << '-' << pass_end << " spp: " << scheduler.tile_count()
+                      << " tiles on " << scheduler.thread_count() << " threads\n";
+
+            scheduler.run([&](const tile& t, int /*thread_id*/) {
+                path_statistics tile_stats;
+                for (int j = t.y0; j < t.y1; ++j) {
+                    for (int i = t.x0; i < t.x1; ++i) {
+                        if (pixel_done(i, j, pass_end)) continue;
+                        pass_rendered = true;
+
+                        color pixel_color(0, 0, 0);
+                        double luminance_sq = 0;
+                        int first_sample = image.sample_count(i, j);
+                        for (int cnt = first_sample; cnt < pass_end; cnt++) {
+                            thread_sample_stream().start_sample(seed, uint64_t(j)*image_width + i, cnt,
+                                                                pixel_sampler.get());
+                            auto u = (i + random_double()) / (image_width-1);
+                            auto v = (j + random_double()) / (image_height-1);
+                            ray r = cam.get_ray(u, v);
+                            auto sample_color = integrator.trace(r, background, world, tile_stats);
+                            pixel_color += sample_color;
+                            luminance_sq += luminance(sample_color) * luminance(sample_color);
+                        }
+                        image.add_samples(i, j, pixel_color, luminance_sq, pass_end - first_sample);
+                    }
+                }
+                thread_sample_stream().stop();
+
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                render_stats.merge(tile_stats);
+#ifdef RT_BVH_STATS
+                render_bvh_counters.merge(thread_bvh_counters().take());
+#endif
+            });
+
+            // When no pixel needed more samples, every pixel has converged and later passes would
+            // find nothing to do either, so this is the last pass as well.
+            auto now = std::chrono::steady_clock::now();
+            bool last_pass = pass_end >= samples_per_pixel || !pass_rendered;
+            if (!checkpoint.empty() && (last_pass ||
+                    std::chrono::duration<double>(now - last_checkpoint).count() >= checkpoint_interval)) {
+                if (!image.save(checkpoint, render_tag))
+                    std::cerr << "\nERROR: Could not write checkpoint '" << checkpoint << "'.\n";
+                last_checkpoint = now;
             }
-            pixels[j][i] = write_color(pixel_color, samples_per_pixel);
+            if (last_pass) break;
         }
-    }
 
-    std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-    for (int j = image_height-1; j >= 0; --j) {
-        for (int i = 0; i < image_width; ++i)
-                std::cout << pixels[j][i][0] << ' ' << pixels[j][i][1] << ' ' << pixels[j][i][2] << std::endl;
+        std::cerr << "\nAverage samples per pixel: " << image.average_sample_count() << '\n';
+        std::cerr << "Average path length: " << render_stats.average_path_length() << '\n';
+#ifdef RT_BVH_STATS
+        render_bvh_counters.print(std::cerr);
+#endif
+
+        if (!write_image(frames > 1 ? numbered_filename(output, frame) : output, image, format)) return 1;
     }
 
     std::cerr << "\nDone.\n";
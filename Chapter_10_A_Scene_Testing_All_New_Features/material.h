@@ -21,6 +21,20 @@ class material
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const = 0;
+
+        virtual bool is_emissive() const { return false; }
+
+        // Materials that can be lit by explicit light samples override these three. eval()
+        // returns the BSDF times the cosine for light leaving towards `direction`, and
+        // scatter_pdf() the density with which scatter() would have picked that direction.
+        // Specular materials keep the defaults and only see lights through scatter().
+        virtual bool is_specular() const { return true; }
+        virtual color eval(const ray& /*r_in*/, const hit_record& /*rec*/, const vec3& /*direction*/) const {
+            return color(0,0,0);
+        }
+        virtual double scatter_pdf(const ray& /*r_in*/, const hit_record& /*rec*/, const vec3& /*direction*/) const {
+            return 0;
+        }
 };
 
 class lambertian : public material 
@@ -39,6 +53,22 @@ class lambertian : public material
             return true;
         }
 
+        // scatter() picks cosine-weighted directions, so albedo = eval / pdf.
+        virtual bool is_specular() const override { return false; }
+
+        virtual color eval(const ray& r_in, const hit_record& rec, const vec3& direction) 
+            const override 
+        {
+            return albedo->value(rec.u, rec.v, rec.p) * scatter_pdf(r_in, rec, direction);
+        }
+
+        virtual double scatter_pdf(const ray& /*r_in*/, const hit_record& rec, const vec3& direction) 
+            const override 
+        {
+            auto cosine = dot(rec.normal, unit_vector(direction));
+            return cosine < 0 ? 0 : cosine / pi;
+        }
+
     public:
         shared_ptr<texture> albedo;
 };
@@ -113,6 +143,8 @@ class diffuse_light : public material
             return emit->value(u, v, p);
         }
 
+        virtual bool is_emissive() const override { return true; }
+
     public:
         shared_ptr<texture> emit;
 };
@@ -130,6 +162,21 @@ class isotropic : public material {
             return true;
         }
 
+        // Directions are uniform over the sphere.
+        virtual bool is_specular() const override { return false; }
+
+        virtual color eval(const ray& /*r_in*/, const hit_record& rec, const vec3& /*direction*/) 
+            const override 
+        {
+            return albedo->value(rec.u, rec.v, rec.p) / (4*pi);
+        }
+
+        virtual double scatter_pdf(const ray& /*r_in*/, const hit_record& /*rec*/, const vec3& /*direction*/) 
+            const override 
+        {
+            return 1 / (4*pi);
+        }
+
     public:
         shared_ptr<texture> albedo;
 };
@@ -0,0 +1,220 @@
+#ifndef MOTION_BVH_H
+#define MOTION_BVH_H
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "linear_bvh.h"
+
+// A flattened BVH node with one box at the shutter open time and one at the close time.
+struct motion_bvh_node
+{
+    float bounds[2][2][3];  // [open/close][min/max][axis]
+    uint32_t offset;        // interior: index of the second child, leaf: first primitive
+    uint16_t count;         // primitives in a leaf, 0 for an interior node
+    uint8_t axis;           // split axis of an interior node
+    uint8_t pad;
+
+    bool is_leaf() const { return count > 0; }
+};
+
+static_assert(sizeof(motion_bvh_node) == 56, "motion_bvh_node should be two boxes and the linear node fields");
+
+// A linear BVH for moving objects. A box built over the whole shutter interval holds
+// everywhere an object goes, so a fast object gets a long box that rays at every time must
+// test. Here each node keeps its box at the open and close times instead, and a ray tests
+// the box interpolated to its own time. For objects that move linearly, like moving_sphere,
+// the interpolated box still holds the object at that time.
+//
+// The tree itself comes from the linear builder run on the whole-interval boxes, and is
+// traversed by the same code, with interpolated_node_box for the box tests.
+class motion_bvh : public hittable
+{
+    public:
+        motion_bvh(hittable_list& list, double time0, double time1,
+                   const bvh_build_options& options = bvh_build_options())
+            : motion_bvh(linear_bvh(list, time0, time1, options), time0, time1, options) {}
+
+        // Takes the tree of an already built linear BVH over the same objects.
+        motion_bvh(const linear_bvh& binary, double time0, double time1,
+                   const bvh_build_options& options = bvh_build_options());
+
+        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+
+        virtual bool bounding_box(double /*t0*/, double /*t1*/, aabb& output_box) const override
+        {
+            output_box = box;
+            return !nodes.empty();
+        }
+
+        virtual void collect_lights(std::vector<shared_ptr<hittable>>& lights) const override;
+
+        // Expected cost of tracing a ray that hits the root box, under the SAH cost model,
+        // with each box's area averaged over the shutter interval.
+        double sah_cost(const bvh_build_options& options = bvh_build_options()) const;
+
+        size_t node_count() const { return nodes.size(); }
+
+        // Recomputes the open and close boxes of every node bottom-up from the primitives'
+        // current bounds at time0 and time1, keeping the tree as it is.
+        void refit(double time0, double time1);
+
+        // Builds a new tree over the same primitives.
+        void rebuild(double time0, double time1, const bvh_build_options& options = bvh_build_options());
+
+    private:
+        double shutter_fraction(const ray& r) const;
+        double node_area(const motion_bvh_node& node) const;
+        double sah_cost(uint32_t index, const bvh_build_options& options) const;
+
+    public:
+        std::vector<motion_bvh_node> nodes;
+        std::vector<shared_ptr<hittable>> primitives;
+        aabb box;               // bounds over the whole shutter interval
+        double time0, time1;    // times the open and close boxes belong to
+        double built_cost = 0;  // SAH cost right after the last build
+};
+
+motion_bvh::motion_bvh(const linear_bvh& binary, double time0, double time1, const bvh_build_options& options)
+    : time0(time0), time1(time1)
+{
+    if (binary.nodes.empty()) return;
+
+    primitives = binary.primitives;
+    nodes.resize(binary.nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++) {
+        nodes[i].offset = binary.nodes[i].offset;
+        nodes[i].count = binary.nodes[i].count;
+        nodes[i].axis = binary.nodes[i].axis;
+        nodes[i].pad = 0;
+    }
+
+    refit(time0, time1);
+    built_cost = sah_cost(options);
+}
+
+void motion_bvh::refit(double t0, double t1)
+{
+    time0 = t0;
+    time1 = t1;
+
+    // Children are stored after their parent, so a backwards sweep sees them first.
+    std::vector<aabb> boxes[2] = { std::vector<aabb>(nodes.size()), std::vector<aabb>(nodes.size()) };
+    const double times[2] = { time0, time1 };
+
+    for (size_t i = nodes.size(); i-- > 0; ) {
+        auto& node = nodes[i];
+        for (int k = 0; k < 2; k++) {
+            auto node_box = aabb::empty();
+            if (node.is_leaf()) {
+                for (uint32_t p = 0; p < node.count; p++) {
+                    aabb prim_box;
+                    if (primitives[node.offset + p]->bounding_box(times[k], times[k], prim_box))
+                        node_box = surrounding_box(node_box, prim_box);
+                }
+            }
+            else {
+                node_box = surrounding_box(boxes[k][i + 1], boxes[k][node.offset]);
+            }
+            boxes[k][i] = node_box;
+
+            for (int a = 0; a < 3; a++) {
+                node.bounds[k][0][a] = std::nextafter(static_cast<float>(node_box.min()[a]), -INFINITY);
+                node.bounds[k][1][a] = std::nextafter(static_cast<float>(node_box.max()[a]),  INFINITY);
+            }
+        }
+    }
+
+    if (!nodes.empty()) box = surrounding_box(boxes[0][0], boxes[1][0]);
+}
+
+void motion_bvh::rebuild(double t0, double t1, const bvh_build_options& options)
+{
+    hittable_list list;
+    list.objects = primitives;
+    *this = motion_bvh(list, t0, t1, options);
+}
+
+// The slab test of linear_node_box against a node's box interpolated to shutter fraction s.
+struct interpolated_node_box
+{
+    double s;
+
+    bool hit(const motion_bvh_node& node, const ray& r, double t_min, double t_max, double& t_entry) const
+    {
+        for (int a = 0; a < 3; a++) {
+            double lo = node.bounds[0][r.sign[a]][a], hi = node.bounds[0][1-r.sign[a]][a];
+            lo += s * (node.bounds[1][r.sign[a]][a] - lo);
+            hi += s * (node.bounds[1][1-r.sign[a]][a] - hi);
+
+            auto t0 = (lo - r.orig[a]) * r.inv_dir[a];
+            auto t1 = (hi - r.orig[a]) * r.inv_dir[a];
+            t1 *= 1 + 2*aabb::slab_gamma;
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+        }
+        t_entry = t_min;
+        return t_min <= t_max;
+    }
+};
+
+// Where the ray's time falls between the open and close boxes. Times outside the interval
+// extrapolate, as moving_sphere::center() does.
+double motion_bvh::shutter_fraction(const ray& r) const
+{
+    return time1 > time0 ? (r.time() - time0) / (time1 - time0) : 0.0;
+}
+
+bool motion_bvh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+    if (nodes.empty()) return false;
+    return linear_bvh_closest_hit(nodes.data(), primitives, interpolated_node_box{ shutter_fraction(r) },
+                                  r, t_min, t_max, rec);
+}
+
+bool motion_bvh::occluded(const ray& r, double t_min, double t_max) const
+{
+    if (nodes.empty()) return false;
+    return linear_bvh_any_hit(nodes.data(), primitives, interpolated_node_box{ shutter_fraction(r) }, r, t_min, t_max);
+}
+
+void motion_bvh::collect_lights(std::vector<shared_ptr<hittable>>& lights) const
+{
+    collect_emitters(primitives, lights);
+}
+
+// A box moving linearly has a surface area quadratic in time, so the mean over the interval
+// is not simply the mean of the two ends. Three-point Simpson integration is exact for it.
+double motion_bvh::node_area(const motion_bvh_node& node) const
+{
+    auto area = [&](double s) {
+        double d[3];
+        for (int a = 0; a < 3; a++) {
+            double lo = node.bounds[0][0][a] + s * (node.bounds[1][0][a] - node.bounds[0][0][a]);
+            double hi = node.bounds[0][1][a] + s * (node.bounds[1][1][a] - node.bounds[0][1][a]);
+            d[a] = hi - lo;
+        }
+        return 2 * (d[0]*d[1] + d[1]*d[2] + d[2]*d[0]);
+    };
+    return (area(0) + 4*area(0.5) + area(1)) / 6;
+}
+
+double motion_bvh::sah_cost(const bvh_build_options& options) const
+{
+    return nodes.empty() ? 0.0 : sah_cost(0, options);
+}
+
+double motion_bvh::sah_cost(uint32_t index, const bvh_build_options& options) const
+{
+    const auto& node = nodes[index];
+    if (node.is_leaf()) return options.traversal_cost + options.intersection_cost * node.count;
+
+    auto area = node_area(node);
+    return options.traversal_cost
+         + bvh_area_ratio(node_area(nodes[index + 1]), area) * sah_cost(index + 1, options)
+         + bvh_area_ratio(node_area(nodes[node.offset]), area) * sah_cost(node.offset, options);
+}
+
+#endif
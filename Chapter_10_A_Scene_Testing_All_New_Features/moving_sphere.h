@@ -13,6 +13,7 @@ class moving_sphere : public hittable
         ) : center0(cen0), center1(cen1), time0(t0), time1(t1), radius(r), mat_ptr(m) {};
 
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
 
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const override;
 
@@ -27,37 +28,21 @@ class moving_sphere : public hittable
 
 bool moving_sphere::hit(const ray &r, double t_min, double t_max, hit_record &rec) const 
 {
-    vec3 oc = r.origin() - center(r.time());
-    auto a = r.direction().length_squared();
-    auto half_b = dot(oc, r.direction());
-    auto c = oc.length_squared() - radius*radius;
+    double t;
+    if (!sphere_root(r, center(r.time()), radius, t_min, t_max, t)) return false;
 
-    auto discriminant = half_b*half_b - a*c;
-
-    if (discriminant > 0) {
-        auto root = sqrt(discriminant);
-
-        auto temp = (-half_b - root) / a;
-        if (temp < t_max && temp > t_min) {
-            rec.t = temp;
-            rec.p = r.at(rec.t);
-            auto outward_normal = (rec.p - center(r.time())) / radius;
-            rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
-            return true;
-        }
+    rec.t = t;
+    rec.p = r.at(rec.t);
+    auto outward_normal = (rec.p - center(r.time())) / radius;
+    rec.set_face_normal(r, outward_normal);
+    rec.mat_ptr = mat_ptr;
+    return true;
+}
 
-        temp = (-half_b + root) / a;
-        if (temp < t_max && temp > t_min) {
-            rec.t = temp;
-            rec.p = r.at(rec.t);
-            auto outward_normal = (rec.p - center(r.time())) / radius;
-            rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
-            return true;
-        }
-    }
-    return false;
+bool moving_sphere::occluded(const ray& r, double t_min, double t_max) const
+{
+    double t;
+    return sphere_root(r, center(r.time()), radius, t_min, t_max, t);
 }
 
 point3 moving_sphere::center(double time) const 
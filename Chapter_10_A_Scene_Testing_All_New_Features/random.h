@@ -0,0 +1,106 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <atomic>
+#include <cstdint>
+
+// SplitMix64 step, used to expand a single seed into a full generator state.
+inline uint64_t splitmix64(uint64_t& x)
+{
+    uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// Stateless 64-bit finalizer (MurmurHash3 fmix64). Every input bit affects every output bit.
+inline uint64_t hash64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+inline double to_unit_double(uint64_t bits)
+{
+    // Top 53 bits scaled into [0,1)
+    return (bits >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// xoshiro256** by Blackman and Vigna. Small, fast and good enough for Monte Carlo work.
+class random_engine
+{
+    public:
+        random_engine() { seed(next_stream_seed()); }
+        random_engine(uint64_t s) { seed(s); }
+
+        void seed(uint64_t s)
+        {
+            for (int i = 0; i < 4; i++) state[i] = splitmix64(s);
+        }
+
+        uint64_t next()
+        {
+            const uint64_t result = rotl(state[1] * 5, 7) * 9;
+            const uint64_t t = state[1] << 17;
+
+            state[2] ^= state[0];
+            state[3] ^= state[1];
+            state[1] ^= state[2];
+            state[0] ^= state[3];
+            state[2] ^= t;
+            state[3] = rotl(state[3], 45);
+
+            return result;
+        }
+
+        double next_double() { return to_unit_double(next()); }
+
+        // Sets the seed that engines created from now on derive their streams from.
+        static void set_base_seed(uint64_t s) { base_seed() = s; stream_counter() = 0; }
+
+    private:
+        static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+        static std::atomic<uint64_t>& base_seed()
+        {
+            static std::atomic<uint64_t> s(0);
+            return s;
+        }
+
+        static std::atomic<uint64_t>& stream_counter()
+        {
+            static std::atomic<uint64_t> n(0);
+            return n;
+        }
+
+        // Every engine gets its own stream: the n-th engine created is seeded from
+        // (base seed, n), so threads never share a sequence.
+        static uint64_t next_stream_seed()
+        {
+            uint64_t x = base_seed() ^ (0x632be59bd9b4e019ull * (stream_counter()++ + 1));
+            return splitmix64(x);
+        }
+
+    private:
+        uint64_t state[4];
+};
+
+// Each thread owns one engine, so drawing a number never touches shared state.
+inline random_engine& thread_random_engine()
+{
+    thread_local random_engine engine;
+    return engine;
+}
+
+// Reseeds the calling thread's engine and makes engines created later derive from seed.
+inline void seed_random(uint64_t seed)
+{
+    random_engine::set_base_seed(seed);
+    thread_random_engine().seed(seed);
+}
+
+#endif
@@ -3,11 +3,19 @@
 
 #include "vec3.h"
 
+// Besides origin, direction and time, a ray caches the reciprocal of its direction and the
+// sign of each component, which every slab test against a box would otherwise recompute.
 class ray {
     public:
         ray() {}
         ray(const point3& origin, const vec3& direction, double time = 0.0)
-            : orig(origin), dir(direction), tm(time) {}
+            : orig(origin), dir(direction), tm(time) 
+        {
+            for (int a = 0; a < 3; a++) {
+                inv_dir[a] = 1 / dir[a];
+                sign[a] = inv_dir[a] < 0;
+            }
+        }
         point3 origin() const  { return orig; }
         vec3 direction() const { return dir; }
 
@@ -21,7 +29,8 @@ class ray {
         point3 orig;
         vec3 dir;
         double tm;
+        vec3 inv_dir;   // 1/dir per component, +-infinity where dir is zero
+        int sign[3];    // 1 where the direction component is negative
 };
 
 #endif
-
@@ -6,6 +6,8 @@
 #include <limits>
 #include <memory>
 
+#include "sampler.h"
+
 // Usings
 using std::shared_ptr;
 using std::make_shared;
@@ -30,8 +32,11 @@ inline double clamp(double x, double min, double max)
 
 inline double random_double() 
 {
-    // Returns a random real in [0,1)
-    return rand() / (RAND_MAX + 1.0);
+    // Returns a random real in [0,1). While a pixel sample is being traced the number comes
+    // from the sample's counter-based stream, otherwise from the calling thread's engine.
+    auto& stream = thread_sample_stream();
+    if (stream.is_active()) return stream.next_double();
+    return thread_random_engine().next_double();
 }
 
 inline double random_double(double min, double max) 
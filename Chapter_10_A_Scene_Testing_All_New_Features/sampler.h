@@ -0,0 +1,269 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "random.h"
+
+// A sampler hands out the random numbers of a pixel sample one dimension at a time. Pixel
+// jitter, lens and time come from the camera's dimensions, every bounce after that gets a
+// block of its own, so the first draws of a bounce (e.g. the two angles of a diffuse
+// direction) can be stratified against the same draws of the pixel's other samples.
+class sampler
+{
+    public:
+        virtual ~sampler() {}
+
+        // Dimension `dimension` of sample `index`, for the pixel identified by the hashed
+        // `pixel_key`. Returns a value in [0,1).
+        virtual double get(uint64_t pixel_key, uint32_t index, uint32_t dimension) const = 0;
+};
+
+inline uint32_t reverse_bits(uint32_t x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+inline uint64_t dimension_key(uint64_t pixel_key, uint32_t dimension)
+{
+    return hash64(pixel_key ^ (0x9e3779b97f4a7c15ull * (dimension + 1)));
+}
+
+// Kensler's hash-based permutation of [0,l), chosen by `p`.
+inline uint32_t permute_index(uint32_t i, uint32_t l, uint32_t p)
+{
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= p;             i *= 0xe170893d;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;        i *= 0x0929eb3f;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;  i *= 1 | p >> 27;
+                            i *= 0x6935fa69;
+        i ^= (i & w) >> 11; i *= 0x74dcb303;
+        i ^= (i & w) >> 2;  i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;  i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
+// Jittered strata: every dimension is split into samples_per_pixel strata, and each
+// pixel visits them in its own shuffled order so that dimensions do not correlate. Sample
+// indices past the stratum count start a fresh, differently shuffled round.
+class stratified_sampler : public sampler
+{
+    public:
+        stratified_sampler(int samples_per_pixel) : strata(samples_per_pixel > 0 ? samples_per_pixel : 1) {}
+
+        virtual double get(uint64_t pixel_key, uint32_t index, uint32_t dimension) const override
+        {
+            auto round = index / strata;
+            auto key = hash64(dimension_key(pixel_key, dimension) + round);
+            auto stratum = permute_index(index % strata, strata, uint32_t(key));
+            auto jitter = to_unit_double(hash64(key + index));
+            return (stratum + jitter) / strata;
+        }
+
+    private:
+        uint32_t strata;
+};
+
+// Halton sequence with one prime base per dimension, decorrelated between pixels by a
+// random toroidal shift (Cranley-Patterson rotation). Dimensions past the prime table are
+// independent.
+class halton_sampler : public sampler
+{
+    public:
+        virtual double get(uint64_t pixel_key, uint32_t index, uint32_t dimension) const override
+        {
+            auto key = dimension_key(pixel_key, dimension);
+            if (dimension >= prime_count) return to_unit_double(hash64(key + index));
+
+            auto x = radical_inverse(primes[dimension], index) + to_unit_double(key);
+            return x >= 1.0 ? x - 1.0 : x;
+        }
+
+    private:
+        static double radical_inverse(uint32_t base, uint32_t index)
+        {
+            double inv_base = 1.0 / base;
+            double inv_base_n = 1.0;
+            uint64_t reversed = 0;
+            while (index) {
+                uint32_t next = index / base;
+                reversed = reversed*base + (index - next*base);
+                inv_base_n *= inv_base;
+                index = next;
+            }
+            return std::min(reversed * inv_base_n, 1.0 - 1e-16);
+        }
+
+        static const uint32_t prime_count = 32;
+        static constexpr uint32_t primes[prime_count] = {
+              2,   3,   5,   7,  11,  13,  17,  19,  23,  29,  31,  37,  41,  43,  47,  53,
+             59,  61,  67,  71,  73,  79,  83,  89,  97, 101, 103, 107, 109, 113, 127, 131
+        };
+};
+
+// Owen-scrambled Sobol points after Burley, "Practical Hash-based Owen Scrambling" (2020).
+// The sequence is 4D; higher dimensions are padded with further 4D sets whose sample order
+// is shuffled per pixel and per set, which keeps the sets independent of each other.
+class sobol_sampler : public sampler
+{
+    public:
+        sobol_sampler()
+        {
+            // Primitive polynomial degree s, coefficients a and initial numbers m of the
+            // Joe-Kuo direction numbers for dimensions 2-4. Dimension 1 is van der Corput.
+            const int s[3] = { 1, 2, 3 };
+            const int a[3] = { 0, 1, 1 };
+            const uint32_t m[3][3] = { { 1, 0, 0 }, { 1, 3, 0 }, { 1, 3, 1 } };
+
+            for (int i = 0; i < 32; i++) directions[0][i] = 1u << (31 - i);
+
+            for (int d = 1; d < 4; d++) {
+                auto v = directions[d];
+                int deg = s[d-1];
+                for (int i = 0; i < deg; i++) v[i] = m[d-1][i] << (31 - i);
+                for (int i = deg; i < 32; i++) {
+                    v[i] = v[i-deg] ^ (v[i-deg] >> deg);
+                    for (int k = 1; k < deg; k++)
+                        v[i] ^= ((a[d-1] >> (deg-1-k)) & 1) * v[i-k];
+                }
+            }
+        }
+
+        virtual double get(uint64_t pixel_key, uint32_t index, uint32_t dimension) const override
+        {
+            auto set_seed = dimension_key(pixel_key, dimension / 4);
+            auto shuffled = nested_uniform_scramble(index, uint32_t(set_seed));
+            auto x = sobol(shuffled, dimension % 4);
+            x = nested_uniform_scramble(x, uint32_t(hash64(set_seed + dimension % 4)));
+            return x * (1.0 / 4294967296.0);
+        }
+
+    private:
+        uint32_t sobol(uint32_t index, int d) const
+        {
+            uint32_t x = 0;
+            for (int bit = 0; index; index >>= 1, bit++)
+                if (index & 1) x ^= directions[d][bit];
+            return x;
+        }
+
+        static uint32_t laine_karras_permutation(uint32_t x, uint32_t seed)
+        {
+            x += seed;
+            x ^= x * 0x6c50b47cu;
+            x ^= x * 0xb82f1e52u;
+            x ^= x * 0xc7afe638u;
+            x ^= x * 0x8d22f6e6u;
+            return x;
+        }
+
+        static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+        {
+            return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+        }
+
+    private:
+        uint32_t directions[4][32];
+};
+
+// Counter-based random numbers for rendering. Instead of advancing a sequential state, the
+// n-th number of a sample is a function of (seed, pixel, sample index, bounce, dimension),
+// so it comes out the same no matter which thread renders the pixel or in what order. The
+// first dimensions_per_bounce numbers of each bounce come from the sampler when one is
+// set, the rest (and all of them otherwise) are hashed.
+class sample_stream
+{
+    public:
+        static const uint32_t dimensions_per_bounce = 8;
+
+        sample_stream()
+            : active(false), smp(nullptr), pixel_key(0), seed(0), bounce_key(0),
+              sample_index(0), bounce(0), dimension(0) {}
+
+        // Starts sample `index` of pixel `pixel_index` with the camera dimensions.
+        void start_sample(uint64_t seed_value, uint64_t pixel_index, uint64_t index,
+                          const sampler* s = nullptr)
+        {
+            active = true;
+            smp = s;
+            pixel_key = hash64(seed_value ^ hash64(pixel_index));
+            seed = hash64(pixel_key + index);
+            sample_index = uint32_t(index);
+            bounce = 0;
+            start_dimensions();
+        }
+
+        // Moves on to the next path vertex; bounce 0 belongs to the camera.
+        void next_bounce()
+        {
+            bounce++;
+            start_dimensions();
+        }
+
+        void stop() { active = false; }
+        bool is_active() const { return active; }
+
+        double next_double()
+        {
+            if (smp && dimension < dimensions_per_bounce)
+                return smp->get(pixel_key, sample_index, bounce*dimensions_per_bounce + dimension++);
+            return to_unit_double(hash64(bounce_key + 0x9e3779b97f4a7c15ull * ++dimension));
+        }
+
+    private:
+        void start_dimensions()
+        {
+            bounce_key = hash64(seed ^ (0xd6e8feb86659fd93ull * (bounce + 1)));
+            dimension = 0;
+        }
+
+    private:
+        bool active;
+        const sampler* smp;
+        uint64_t pixel_key;
+        uint64_t seed;
+        uint64_t bounce_key;
+        uint32_t sample_index;
+        uint32_t bounce;
+        uint32_t dimension;
+};
+
+inline sample_stream& thread_sample_stream()
+{
+    thread_local sample_stream stream;
+    return stream;
+}
+
+// Creates the sampler called `name`; "independent" leaves `smp` empty, which makes the
+// sample stream hash every dimension.
+inline bool make_sampler(const std::string& name, int samples_per_pixel, std::shared_ptr<sampler>& smp)
+{
+    if      (name == "independent") smp = nullptr;
+    else if (name == "stratified")  smp = std::make_shared<stratified_sampler>(samples_per_pixel);
+    else if (name == "halton")      smp = std::make_shared<halton_sampler>();
+    else if (name == "sobol")       smp = std::make_shared<sobol_sampler>();
+    else return false;
+    return true;
+}
+
+#endif
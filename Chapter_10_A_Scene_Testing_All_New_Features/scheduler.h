@@ -0,0 +1,192 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A rectangular block of pixels covering [x0,x1) x [y0,y1)
+struct tile
+{
+    int x0, y0;
+    int x1, y1;
+};
+
+// Per-worker queue of tiles. The owner takes work from the back, idle workers steal
+// from the front so that the two ends rarely contend for the same tile.
+class tile_queue
+{
+    public:
+        void push(const tile& t)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tiles.push_back(t);
+        }
+
+        bool pop(tile& t)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (tiles.empty()) return false;
+            t = tiles.back();
+            tiles.pop_back();
+            return true;
+        }
+
+        bool steal(tile& t)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (tiles.empty()) return false;
+            t = tiles.front();
+            tiles.pop_front();
+            return true;
+        }
+
+    private:
+        std::mutex mutex;
+        std::deque<tile> tiles;
+};
+
+// Renders the tiles of an image on a pool of worker threads that lives as long as the
+// scheduler, so a render made of many passes starts its threads once. Each run() deals
+// every tile out again and wakes the workers; they steal from each other once their own
+// queue runs dry.
+class tile_scheduler
+{
+    public:
+        // A thread count of 0 sizes the pool to the machine.
+        tile_scheduler(int image_width, int image_height, int tile_size = 16, int num_threads = 0);
+        ~tile_scheduler();
+
+        tile_scheduler(const tile_scheduler&) = delete;
+        tile_scheduler& operator=(const tile_scheduler&) = delete;
+
+        int thread_count() const { return static_cast<int>(queues.size()); }
+        int tile_count() const { return static_cast<int>(tiles.size()); }
+
+        // Calls render_tile(t, thread_id) once for every tile of the image and returns when
+        // all of them are done. The calling thread works as thread 0.
+        void run(const std::function<void(const tile&, int)>& render_tile);
+
+    private:
+        bool next_tile(int thread_id, tile& t);
+        void work(int thread_id, const std::function<void(const tile&, int)>& render_tile);
+        void worker(int thread_id);
+
+    private:
+        std::vector<tile> tiles;
+        std::vector<tile_queue> queues;
+        std::vector<std::thread> threads;
+        std::atomic<int> tiles_done;
+
+        // The current run, guarded by mutex. Workers wait for generation to change and
+        // report back through busy.
+        std::mutex mutex;
+        std::condition_variable start, finished;
+        const std::function<void(const tile&, int)>* job = nullptr;
+        uint64_t generation = 0;
+        int busy = 0;
+        bool stopping = false;
+};
+
+tile_scheduler::tile_scheduler(int image_width, int image_height, int tile_size, int num_threads)
+    : queues(num_threads > 0 ? num_threads : std::max(1u, std::thread::hardware_concurrency())),
+      tiles_done(0)
+{
+    // Tiles are dealt from the top row down, like the scanline loop did.
+    for (int y1 = image_height; y1 > 0; y1 -= tile_size) {
+        for (int x0 = 0; x0 < image_width; x0 += tile_size) {
+            tile t;
+            t.x0 = x0;
+            t.x1 = std::min(x0 + tile_size, image_width);
+            t.y0 = std::max(y1 - tile_size, 0);
+            t.y1 = y1;
+            tiles.push_back(t);
+        }
+    }
+
+    for (int id = 1; id < thread_count(); id++) threads.emplace_back(&tile_scheduler::worker, this, id);
+}
+
+tile_scheduler::~tile_scheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    start.notify_all();
+    for (auto& thread : threads) thread.join();
+}
+
+bool tile_scheduler::next_tile(int thread_id, tile& t)
+{
+    if (queues[thread_id].pop(t)) return true;
+
+    // Our own queue ran dry, so try to steal from the others. Tiles are never added while
+    // a run is under way, so a full sweep that finds nothing means we are done.
+    int n = thread_count();
+    for (int k = 1; k < n; k++)
+        if (queues[(thread_id + k) % n].steal(t)) return true;
+
+    return false;
+}
+
+void tile_scheduler::work(int thread_id, const std::function<void(const tile&, int)>& render_tile)
+{
+    tile t;
+    while (next_tile(thread_id, t)) {
+        render_tile(t, thread_id);
+        int done = ++tiles_done;
+        if (thread_id == 0) std::cerr << "\rTiles remaining: " << tile_count() - done << ' ' << std::flush;
+    }
+}
+
+void tile_scheduler::worker(int thread_id)
+{
+    uint64_t seen = 0;
+    while (true) {
+        const std::function<void(const tile&, int)>* render_tile;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            start.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            render_tile = job;
+        }
+
+        work(thread_id, *render_tile);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busy == 0) finished.notify_one();
+    }
+}
+
+void tile_scheduler::run(const std::function<void(const tile&, int)>& render_tile)
+{
+    // Deal the tiles out round-robin before any worker is woken.
+    for (size_t k = 0; k < tiles.size(); k++) queues[k % queues.size()].push(tiles[k]);
+    tiles_done = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &render_tile;
+        busy = static_cast<int>(threads.size());
+        generation++;
+    }
+    start.notify_all();
+
+    work(0, render_tile);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&] { return busy == 0; });
+    job = nullptr;
+    std::cerr << "\rTiles remaining: 0 " << std::flush;
+}
+
+#endif
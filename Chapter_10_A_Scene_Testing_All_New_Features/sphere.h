@@ -2,6 +2,8 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "material.h"
+#include "onb.h"
 
 class sphere : public hittable 
 {
@@ -11,8 +13,13 @@ class sphere : public hittable
             : center(cen), radius(r), mat_ptr(m) {};
 
         virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
         virtual bool bounding_box(double t0, double t1, aabb& output_box) const override;
 
+        virtual bool is_emitter() const override { return mat_ptr->is_emissive(); }
+        virtual double pdf_value(const point3& o, const vec3& v) const override;
+        virtual vec3 random(const point3& o) const override;
+
     public:
         point3 center;
         double radius;
@@ -26,43 +33,25 @@ void get_sphere_uv(const vec3& p, double& u, double& v) {
     v = (theta + pi/2) / pi;
 }
 
+bool sphere::occluded(const ray& r, double t_min, double t_max) const
+{
+    double t;
+    return sphere_root(r, center, radius, t_min, t_max, t);
+}
+
 bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const 
 {
-    vec3 oc = r.origin() - center;
-    auto a = r.direction().length_squared();
-    auto half_b = dot(oc, r.direction());
-    auto c = oc.length_squared() - radius*radius;
-    auto discriminant = half_b*half_b - a*c;
-
-    if (discriminant > 0) {
-        auto root = sqrt(discriminant);
-
-        auto temp = (-half_b - root) / a;
-        if (temp < t_max && temp > t_min) {
-            rec.t = temp;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center) / radius;
-            rec.set_face_normal(r, outward_normal);
-            get_sphere_uv((rec.p-center)/radius, rec.u, rec.v);
-
-            rec.mat_ptr = mat_ptr;
-            return true;
-        }
-
-        temp = (-half_b + root) / a;
-        if (temp < t_max && temp > t_min) {
-            rec.t = temp;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center) / radius;
-            rec.set_face_normal(r, outward_normal);
-            get_sphere_uv((rec.p-center)/radius, rec.u, rec.v);
-
-            rec.mat_ptr = mat_ptr;
-            return true;
-        }
-    }
-
-    return false;
+    double t;
+    if (!sphere_root(r, center, radius, t_min, t_max, t)) return false;
+
+    rec.t = t;
+    rec.p = r.at(rec.t);
+    vec3 outward_normal = (rec.p - center) / radius;
+    rec.set_face_normal(r, outward_normal);
+    get_sphere_uv((rec.p-center)/radius, rec.u, rec.v);
+
+    rec.mat_ptr = mat_ptr;
+    return true;
 }
 
 bool sphere::bounding_box(double t0, double t1, aabb& output_box) const 
@@ -72,4 +61,39 @@ bool sphere::bounding_box(double t0, double t1, aabb& output_box) const
     return true;
 }
 
+// Samples are spread uniformly over the cone of directions from `o` that hit the sphere.
+// From inside the sphere every direction hits it, so they are spread over the whole sphere.
+double sphere::pdf_value(const point3& o, const vec3& v) const
+{
+    auto distance_squared = (center - o).length_squared();
+    if (distance_squared <= radius*radius) return 1 / (4*pi);
+
+    hit_record rec;
+    if (!this->hit(ray(o, v), 0.001, infinity, rec)) return 0;
+
+    auto cos_theta_max = sqrt(1 - radius*radius/distance_squared);
+    auto solid_angle = 2*pi*(1-cos_theta_max);
+
+    return 1 / solid_angle;
+}
+
+vec3 sphere::random(const point3& o) const
+{
+    vec3 direction = center - o;
+    auto distance_squared = direction.length_squared();
+    if (distance_squared <= radius*radius) return random_unit_vector();
+
+    auto r1 = random_double();
+    auto r2 = random_double();
+    auto z = 1 + r2*(sqrt(1-radius*radius/distance_squared) - 1);
+
+    auto phi = 2*pi*r1;
+    auto x = cos(phi)*sqrt(1-z*z);
+    auto y = sin(phi)*sqrt(1-z*z);
+
+    onb uvw;
+    uvw.build_from_w(direction);
+    return uvw.local(x, y, z);
+}
+
 #endif
@@ -0,0 +1,127 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "rtweekend.h"
+#include "aabb.h"
+
+// Affine transform: a 3x3 linear part in columns 0-2 and a translation in column 3.
+// The inverse is kept alongside and composed in reverse order, so it never has to be
+// computed from the matrix.
+class transform
+{
+    public:
+        transform()
+        {
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 4; j++)
+                    m[i][j] = inv[i][j] = (i == j) ? 1.0 : 0.0;
+        }
+
+        static transform translation(const vec3& offset)
+        {
+            transform t;
+            for (int i = 0; i < 3; i++) {
+                t.m[i][3] = offset[i];
+                t.inv[i][3] = -offset[i];
+            }
+            return t;
+        }
+
+        static transform rotation_y(double angle)
+        {
+            auto radians = degrees_to_radians(angle);
+            auto s = sin(radians);
+            auto c = cos(radians);
+
+            transform t;
+            t.m[0][0] =  c; t.m[0][2] = s;
+            t.m[2][0] = -s; t.m[2][2] = c;
+            t.inv[0][0] = c; t.inv[0][2] = -s;
+            t.inv[2][0] = s; t.inv[2][2] =  c;
+            return t;
+        }
+
+        static transform scaling(double factor)
+        {
+            transform t;
+            for (int i = 0; i < 3; i++) {
+                t.m[i][i] = factor;
+                t.inv[i][i] = 1 / factor;
+            }
+            return t;
+        }
+
+        // The transform that applies b first and then this one.
+        transform operator*(const transform& b) const
+        {
+            transform t;
+            multiply(m, b.m, t.m);
+            multiply(b.inv, inv, t.inv);
+            return t;
+        }
+
+        point3 point(const point3& p) const { return apply(m, p, 1); }
+        vec3 vector(const vec3& v) const { return apply(m, v, 0); }
+        point3 inverse_point(const point3& p) const { return apply(inv, p, 1); }
+        vec3 inverse_vector(const vec3& v) const { return apply(inv, v, 0); }
+
+        // Normals go through the inverse transpose, which keeps them perpendicular to
+        // the transformed surface under non-uniform scaling.
+        vec3 normal(const vec3& n) const
+        {
+            return vec3(inv[0][0]*n[0] + inv[1][0]*n[1] + inv[2][0]*n[2],
+                        inv[0][1]*n[0] + inv[1][1]*n[1] + inv[2][1]*n[2],
+                        inv[0][2]*n[0] + inv[1][2]*n[1] + inv[2][2]*n[2]);
+        }
+
+        // Determinant of the linear part of the inverse: the factor by which taking things
+        // to object space scales volumes.
+        double inverse_determinant() const
+        {
+            return inv[0][0]*(inv[1][1]*inv[2][2] - inv[1][2]*inv[2][1])
+                 - inv[0][1]*(inv[1][0]*inv[2][2] - inv[1][2]*inv[2][0])
+                 + inv[0][2]*(inv[1][0]*inv[2][1] - inv[1][1]*inv[2][0]);
+        }
+
+        // Box around the eight transformed corners of b
+        aabb box(const aabb& b) const
+        {
+            point3 min( infinity,  infinity,  infinity);
+            point3 max(-infinity, -infinity, -infinity);
+            for (int c = 0; c < 8; c++) {
+                point3 corner((c & 1) ? b.max().x() : b.min().x(),
+                              (c & 2) ? b.max().y() : b.min().y(),
+                              (c & 4) ? b.max().z() : b.min().z());
+                auto p = point(corner);
+                for (int a = 0; a < 3; a++) {
+                    min[a] = fmin(min[a], p[a]);
+                    max[a] = fmax(max[a], p[a]);
+                }
+            }
+            return aabb(min, max);
+        }
+
+    private:
+        static vec3 apply(const double a[3][4], const vec3& v, double w)
+        {
+            return vec3(a[0][0]*v[0] + a[0][1]*v[1] + a[0][2]*v[2] + w*a[0][3],
+                        a[1][0]*v[0] + a[1][1]*v[1] + a[1][2]*v[2] + w*a[1][3],
+                        a[2][0]*v[0] + a[2][1]*v[1] + a[2][2]*v[2] + w*a[2][3]);
+        }
+
+        static void multiply(const double a[3][4], const double b[3][4], double out[3][4])
+        {
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 4; j++) {
+                    out[i][j] = a[i][0]*b[0][j] + a[i][1]*b[1][j] + a[i][2]*b[2][j];
+                    if (j == 3) out[i][j] += a[i][3];
+                }
+            }
+        }
+
+    public:
+        double m[3][4];     // object to world
+        double inv[3][4];   // world to object
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef TRAVERSAL_STACK_H
+#define TRAVERSAL_STACK_H
+
+#include <algorithm>
+#include <vector>
+
+// The explicit stack of an iterative BVH traversal. The first Size entries live in the
+// object itself, which covers the trees the builders normally make without touching the
+// heap. A deeper tree, or one read from a file, moves the stack to a growing vector
+// instead of running off the end.
+template <typename T, int Size = 64>
+class traversal_stack
+{
+    public:
+        traversal_stack() : items(local), capacity(Size) {}
+
+        traversal_stack(const traversal_stack&) = delete;
+        traversal_stack& operator=(const traversal_stack&) = delete;
+
+        bool empty() const { return count == 0; }
+        int size() const { return count; }
+
+        void push(const T& item)
+        {
+            if (count == capacity) grow();
+            items[count++] = item;
+        }
+
+        T pop() { return items[--count]; }
+        const T& top() const { return items[count - 1]; }
+
+        T& operator[](int i) { return items[i]; }
+        const T& operator[](int i) const { return items[i]; }
+
+    private:
+        void grow()
+        {
+            capacity *= 2;
+            heap.resize(capacity);
+            if (items == local) std::copy(local, local + count, heap.begin());
+            items = heap.data();
+        }
+
+    private:
+        T local[Size];
+        std::vector<T> heap;
+        T* items;
+        int capacity;
+        int count = 0;
+};
+
+#endif
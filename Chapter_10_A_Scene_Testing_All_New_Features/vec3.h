@@ -151,12 +151,23 @@ vec3 random_in_hemisphere(const vec3& normal) {
         return -in_unit_sphere;
 }
 
+// Uniform in the unit disk, by Shirley and Chiu's concentric mapping of the square onto
+// the disk. Unlike rejection it takes exactly two random numbers, so a sampler's strata of
+// those two dimensions stay strata of the disk and the dimensions after it stay in place.
 vec3 random_in_unit_disk() {
-    while (true) {
-        auto p = vec3(random_double(-1,1), random_double(-1,1), 0);
-        if (p.length_squared() >= 1) continue;
-        return p;
+    auto a = random_double(-1,1);
+    auto b = random_double(-1,1);
+    if (a == 0 && b == 0) return vec3(0,0,0);
+
+    double r, phi;
+    if (fabs(a) > fabs(b)) {
+        r = a;
+        phi = (pi/4) * (b/a);
+    } else {
+        r = b;
+        phi = pi/2 - (pi/4) * (a/b);
     }
+    return vec3(r*cos(phi), r*sin(phi), 0);
 }
 
 vec3 reflect(const vec3& v, const vec3& n) {
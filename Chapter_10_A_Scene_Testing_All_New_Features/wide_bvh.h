@@ -0,0 +1,405 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+#include "linear_bvh.h"
+
+// A node with up to N children whose boxes are stored structure-of-arrays, so one SIMD
+// instruction handles the same slab of every child. The children fill the first slots;
+// unused slots hold an inverted box that no ray can hit. A child can have an inverted box
+// too, when its objects have no bounds at the moment, so the slots in use are counted
+// rather than told apart by their boxes.
+template <int N>
+struct alignas(32) wide_bvh_node
+{
+    float bounds[2][3][N];  // [min/max][axis][child]
+    uint32_t child[N];      // interior child: node index, leaf child: first primitive
+    uint16_t count[N];      // primitives in a leaf child, 0 for an interior child
+    uint8_t children;       // slots in use
+};
+
+// Slab test of a ray against all N children of a node. Returns a bit mask of the children
+// that are hit and writes their entry distances to t_near.
+struct wide_ray
+{
+    float origin[3];
+    float inv_dir[3];
+    int sign[3];
+};
+
+template <int N>
+inline unsigned intersect_children(const wide_bvh_node<N>& node, const wide_ray& r, float t_min, 
+                                   float t_max, float* t_near)
+{
+    unsigned mask = 0;
+    for (int k = 0; k < N; k++) {
+        auto lo = t_min;
+        auto hi = t_max;
+        for (int a = 0; a < 3; a++) {
+            auto t0 = (node.bounds[r.sign[a]][a][k]   - r.origin[a]) * r.inv_dir[a];
+            auto t1 = (node.bounds[1-r.sign[a]][a][k] - r.origin[a]) * r.inv_dir[a];
+            lo = t0 > lo ? t0 : lo;
+            hi = t1 < hi ? t1 : hi;
+        }
+        t_near[k] = lo;
+        if (lo <= hi) mask |= 1u << k;
+    }
+    return mask;
+}
+
+// The SIMD versions mirror the scalar test. max/min return their second operand when the
+// first is NaN, which again leaves the interval untouched for rays lying in a slab plane.
+#if defined(__SSE2__)
+template <>
+inline unsigned intersect_children<4>(const wide_bvh_node<4>& node, const wide_ray& r, float t_min,
+                                      float t_max, float* t_near)
+{
+    auto lo = _mm_set1_ps(t_min);
+    auto hi = _mm_set1_ps(t_max);
+    for (int a = 0; a < 3; a++) {
+        auto o = _mm_set1_ps(r.origin[a]);
+        auto inv = _mm_set1_ps(r.inv_dir[a]);
+        auto t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[r.sign[a]][a]), o), inv);
+        auto t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[1-r.sign[a]][a]), o), inv);
+        lo = _mm_max_ps(t0, lo);
+        hi = _mm_min_ps(t1, hi);
+    }
+    _mm_storeu_ps(t_near, lo);
+    return static_cast<unsigned>(_mm_movemask_ps(_mm_cmple_ps(lo, hi)));
+}
+#endif
+
+#if defined(__AVX__)
+template <>
+inline unsigned intersect_children<8>(const wide_bvh_node<8>& node, const wide_ray& r, float t_min,
+                                      float t_max, float* t_near)
+{
+    auto lo = _mm256_set1_ps(t_min);
+    auto hi = _mm256_set1_ps(t_max);
+    for (int a = 0; a < 3; a++) {
+        auto o = _mm256_set1_ps(r.origin[a]);
+        auto inv = _mm256_set1_ps(r.inv_dir[a]);
+        auto t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[r.sign[a]][a]), o), inv);
+        auto t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[1-r.sign[a]][a]), o), inv);
+        lo = _mm256_max_ps(t0, lo);
+        hi = _mm256_min_ps(t1, hi);
+    }
+    _mm256_storeu_ps(t_near, lo);
+    return static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(lo, hi, _CMP_LE_OQ)));
+}
+#endif
+
+// A BVH with N-way nodes (N = 4 or 8), made by collapsing a binary SAH tree: each wide
+// node takes the children of a binary node and keeps opening the largest interior child
+// among them until it has N. This cuts the tree depth by about log2(N), and each visit
+// tests all children at once with SSE (N = 4) or AVX (N = 8) where the compiler targets
+// them, and with a scalar loop otherwise.
+template <int N>
+class wide_bvh : public hittable
+{
+    public:
+        wide_bvh(hittable_list& list, double time0, double time1,
+                 const bvh_build_options& options = bvh_build_options())
+            : wide_bvh(linear_bvh(list, time0, time1, options), options) {}
+
+        // Collapses an already built binary tree.
+        explicit wide_bvh(const linear_bvh& binary, const bvh_build_options& options = bvh_build_options());
+
+        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+
+        virtual bool bounding_box(double /*t0*/, double /*t1*/, aabb& output_box) const override
+        {
+            output_box = box;
+            return !nodes.empty();
+        }
+
+        virtual void collect_lights(std::vector<shared_ptr<hittable>>& lights) const override;
+
+        size_t node_count() const { return nodes.size(); }
+
+        // Expected cost of tracing a ray that hits the root box, under the SAH cost model
+        // with one traversal step per wide node.
+        double sah_cost(const bvh_build_options& options = bvh_build_options()) const;
+
+        // Recomputes every child box bottom-up from the primitives' current boxes,
+        // keeping the tree as it is.
+        void refit(double time0, double time1);
+
+        // Builds a new tree over the same primitives.
+        void rebuild(double time0, double time1, const bvh_build_options& options = bvh_build_options());
+
+    private:
+        uint32_t collapse(const linear_bvh& binary, const std::vector<uint32_t>& start);
+        double sah_cost(uint32_t index, double area, const bvh_build_options& options) const;
+        static double slot_area(const wide_bvh_node<N>& node, int k);
+
+    public:
+        std::vector<wide_bvh_node<N>> nodes;
+        std::vector<shared_ptr<hittable>> primitives;
+        aabb box;
+        double built_cost = 0;  // SAH cost right after the last build
+};
+
+using bvh4 = wide_bvh<4>;
+using bvh8 = wide_bvh<8>;
+
+template <int N>
+wide_bvh<N>::wide_bvh(const linear_bvh& binary, const bvh_build_options& options)
+{
+    if (binary.nodes.empty()) return;
+
+    primitives = binary.primitives;
+    box = binary.box;
+
+    // The root's children, or the root itself when the whole tree is a single leaf
+    if (binary.nodes[0].is_leaf()) collapse(binary, { 0 });
+    else collapse(binary, { 1, binary.nodes[0].offset });
+
+    built_cost = sah_cost(options);
+}
+
+template <int N>
+uint32_t wide_bvh<N>::collapse(const linear_bvh& binary, const std::vector<uint32_t>& start)
+{
+    auto children = start;
+    while (children.size() < N) {
+        int largest = -1;
+        double largest_area = -1;
+        for (size_t k = 0; k < children.size(); k++) {
+            const auto& node = binary.nodes[children[k]];
+            if (node.is_leaf()) continue;
+            auto area = binary.node_area(node);
+            if (area > largest_area) {
+                largest_area = area;
+                largest = static_cast<int>(k);
+            }
+        }
+        if (largest < 0) break;
+
+        auto index = children[largest];
+        children[largest] = index + 1;
+        children.push_back(binary.nodes[index].offset);
+    }
+
+    auto index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    wide_bvh_node<N> node;
+    for (int k = 0; k < N; k++) {
+        for (int a = 0; a < 3; a++) {
+            node.bounds[0][a][k] =  INFINITY;
+            node.bounds[1][a][k] = -INFINITY;
+        }
+        node.child[k] = 0;
+        node.count[k] = 0;
+    }
+    node.children = static_cast<uint8_t>(children.size());
+
+    for (size_t k = 0; k < children.size(); k++) {
+        const auto& child = binary.nodes[children[k]];
+        for (int a = 0; a < 3; a++) {
+            node.bounds[0][a][k] = child.bounds[0][a];
+            node.bounds[1][a][k] = child.bounds[1][a];
+        }
+        if (child.is_leaf()) {
+            node.child[k] = child.offset;
+            node.count[k] = child.count;
+        }
+        else {
+            node.child[k] = collapse(binary, { children[k] + 1, child.offset });
+        }
+    }
+
+    nodes[index] = node;
+    return index;
+}
+
+template <int N>
+bool wide_bvh<N>::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+    if (nodes.empty()) return false;
+
+    wide_ray wr;
+    for (int a = 0; a < 3; a++) {
+        wr.origin[a] = static_cast<float>(r.orig[a]);
+        wr.inv_dir[a] = static_cast<float>(r.inv_dir[a]);
+        wr.sign[a] = r.sign[a];
+    }
+
+    // Pending children: node index or primitive range, with their entry distances
+    struct entry { uint32_t child; uint16_t count; float t; };
+    traversal_stack<entry, 64 * N> stack;
+    bool hit_anything = false;
+
+    stack.push({ 0, 0, static_cast<float>(t_min) });
+    RT_BVH_COUNT(traversals, 1);
+
+    while (!stack.empty()) {
+        auto item = stack.pop();
+        if (item.t > t_max) continue;
+
+        if (item.count > 0) {
+            RT_BVH_COUNT(primitive_tests, item.count);
+            for (uint32_t i = 0; i < item.count; i++) {
+                if (primitives[item.child + i]->hit(r, t_min, t_max, rec)) {
+                    hit_anything = true;
+                    t_max = rec.t;
+                }
+            }
+            continue;
+        }
+
+        // Widen the float interval a little so float rounding never loses a hit.
+        const auto& node = nodes[item.child];
+        RT_BVH_COUNT(nodes_visited, 1);
+        RT_BVH_COUNT(box_tests, N);
+        alignas(32) float t_near[N];
+        auto mask = intersect_children<N>(node, wr, static_cast<float>(t_min), 
+                                          static_cast<float>(t_max) * 1.00001f, t_near);
+
+        // Push the hit children far to near so that the nearest one is popped first.
+        int first = stack.size();
+        for (int k = 0; k < N; k++) {
+            if (!(mask & (1u << k))) continue;
+            entry e = { node.child[k], node.count[k], t_near[k] };
+            int j = stack.size();
+            stack.push(e);
+            while (j > first && stack[j-1].t < e.t) {
+                stack[j] = stack[j-1];
+                j--;
+            }
+            stack[j] = e;
+        }
+    }
+
+    return hit_anything;
+}
+
+template <int N>
+double wide_bvh<N>::slot_area(const wide_bvh_node<N>& node, int k)
+{
+    double d[3];
+    for (int a = 0; a < 3; a++) {
+        d[a] = double(node.bounds[1][a][k]) - node.bounds[0][a][k];
+        if (!(d[a] >= 0)) return 0.0;   // a child with nothing in it
+    }
+    return 2 * (d[0]*d[1] + d[1]*d[2] + d[2]*d[0]);
+}
+
+template <int N>
+double wide_bvh<N>::sah_cost(const bvh_build_options& options) const
+{
+    return nodes.empty() ? 0.0 : sah_cost(0, box.surface_area(), options);
+}
+
+template <int N>
+double wide_bvh<N>::sah_cost(uint32_t index, double area, const bvh_build_options& options) const
+{
+    const auto& node = nodes[index];
+    auto cost = options.traversal_cost;
+    for (int k = 0; k < node.children; k++) {
+        auto child_area = slot_area(node, k);
+        auto child_cost = node.count[k] > 0 ? options.intersection_cost * node.count[k]
+                                            : sah_cost(node.child[k], child_area, options);
+        cost += bvh_area_ratio(child_area, area) * child_cost;
+    }
+    return cost;
+}
+
+// Like hit(), without sorting the children: the first blocking primitive ends the search.
+template <int N>
+bool wide_bvh<N>::occluded(const ray& r, double t_min, double t_max) const
+{
+    if (nodes.empty()) return false;
+
+    wide_ray wr;
+    for (int a = 0; a < 3; a++) {
+        wr.origin[a] = static_cast<float>(r.orig[a]);
+        wr.inv_dir[a] = static_cast<float>(r.inv_dir[a]);
+        wr.sign[a] = r.sign[a];
+    }
+
+    struct entry { uint32_t child; uint16_t count; };
+    traversal_stack<entry, 64 * N> stack;
+
+    stack.push({ 0, 0 });
+    RT_BVH_COUNT(traversals, 1);
+
+    while (!stack.empty()) {
+        auto item = stack.pop();
+
+        if (item.count > 0) {
+            for (uint32_t i = 0; i < item.count; i++) {
+                RT_BVH_COUNT(primitive_tests, 1);
+                if (primitives[item.child + i]->occluded(r, t_min, t_max)) return true;
+            }
+            continue;
+        }
+
+        const auto& node = nodes[item.child];
+        RT_BVH_COUNT(nodes_visited, 1);
+        RT_BVH_COUNT(box_tests, N);
+        alignas(32) float t_near[N];
+        auto mask = intersect_children<N>(node, wr, static_cast<float>(t_min),
+                                          static_cast<float>(t_max) * 1.00001f, t_near);
+        for (int k = 0; k < N; k++)
+            if (mask & (1u << k)) stack.push({ node.child[k], node.count[k] });
+    }
+
+    return false;
+}
+
+template <int N>
+void wide_bvh<N>::refit(double time0, double time1)
+{
+    // Nodes are stored after their parent, so a backwards sweep sees the children first.
+    std::vector<aabb> boxes(nodes.size());
+    for (size_t i = nodes.size(); i-- > 0; ) {
+        auto& node = nodes[i];
+        auto node_box = aabb::empty();
+        for (int k = 0; k < node.children; k++) {
+            auto child_box = aabb::empty();
+            if (node.count[k] > 0) {
+                for (uint32_t p = 0; p < node.count[k]; p++) {
+                    aabb prim_box;
+                    if (primitives[node.child[k] + p]->bounding_box(time0, time1, prim_box))
+                        child_box = surrounding_box(child_box, prim_box);
+                }
+            }
+            else {
+                child_box = boxes[node.child[k]];
+            }
+
+            for (int a = 0; a < 3; a++) {
+                node.bounds[0][a][k] = std::nextafter(static_cast<float>(child_box.min()[a]), -INFINITY);
+                node.bounds[1][a][k] = std::nextafter(static_cast<float>(child_box.max()[a]),  INFINITY);
+            }
+            node_box = surrounding_box(node_box, child_box);
+        }
+        boxes[i] = node_box;
+    }
+    if (!nodes.empty()) box = boxes[0];
+}
+
+template <int N>
+void wide_bvh<N>::rebuild(double time0, double time1, const bvh_build_options& options)
+{
+    hittable_list list;
+    list.objects = primitives;
+    *this = wide_bvh(list, time0, time1, options);
+}
+
+template <int N>
+void wide_bvh<N>::collect_lights(std::vector<shared_ptr<hittable>>& lights) const
+{
+    collect_emitters(primitives, lights);
+}
+
+#endif